@@ -0,0 +1,53 @@
+# Summarize RAM used by CAN-TS queues, message pool and block transfer buffers.
+# Input is output of "nm -S -t d", one line per symbol: address size type name.
+# Queue storage area (*_queue_buffer) and control block (*_queue_struct) are
+# reported together under queue name, with CAN send heap and ring indices.
+# Simulator ground station objects (ground_*) aren't part of the node.
+
+$4 ~ /^ground_/ {
+	next
+}
+
+$4 ~ /_queue_(buffer|struct)$/ {
+	name = $4
+	sub(/_(buffer|struct)$/, "", name)
+	queue[name] += $2
+	total += $2
+}
+
+$4 ~ /^can_send_heap$/ {
+	queue["can_send_queue"] += $2
+	total += $2
+}
+
+$4 ~ /^dispatcher_(nack_)?(head|tail)$/ {
+	name = $4
+	sub(/_(head|tail)$/, "_queue", name)
+	queue[name] += $2
+	total += $2
+}
+
+$4 ~ /_deadline_heap$/ {
+	queue[$4] += $2
+	total += $2
+}
+
+$4 ~ /^(pool|next_free|rx_time)$/ {
+	pool += $2
+	total += $2
+}
+
+$4 ~ /^block_arena(_free)?$/ {
+	arena += $2
+	total += $2
+}
+
+END {
+	for (name in queue)
+		printf "%-24s %6d bytes\n", name, queue[name]
+	if (pool)
+		printf "%-24s %6d bytes\n", "message pool", pool
+	if (arena)
+		printf "%-24s %6d bytes\n", "block buffer arena", arena
+	printf "%-24s %6d bytes\n", "total", total
+}
@@ -8,6 +8,7 @@ CC := $(COMPILER_PATH)picosky-gcc
 OBJCOPY := $(COMPILER_PATH)picosky-objcopy
 OBJDUMP := $(COMPILER_PATH)picosky-objdump
 SIZE := $(COMPILER_PATH)picosky-size
+NM := $(COMPILER_PATH)picosky-nm
 ifeq ($(OS),Windows_NT)
 	# use toolchain provided programs
 	RM := $(COMPILER_PATH)picosky-rm
@@ -75,6 +76,14 @@ clean: chktarget
 	
 rebuild: clean all
 	
+# RAM used by CAN-TS queues and message pool
+ramreport: chktarget $(EXEDIR)/$(PROJECT).elf
+	@$(NM) -S -t d $(EXEDIR)/$(PROJECT).elf | awk -f mk/ramreport.awk
+
+# host simulator, see sim/Makefile
+sim:
+	@$(MAKE) -C sim
+
 chktarget:
 ifneq ($(TARGET),Debug)
 ifneq ($(TARGET),Release)
@@ -113,4 +122,4 @@ postbin: $(EXEDIR)/$(PROJECT).bin
 	@echo [Post BIN steps]
 	$(call POST_BIN_steps,$(EXEDIR)/$(PROJECT))
 
-.PHONY: all clean rebuild chktarget postbin
+.PHONY: all clean rebuild chktarget postbin ramreport sim
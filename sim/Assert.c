@@ -0,0 +1,27 @@
+/**
+ * @file Assert.c
+ *
+ */
+
+/**
+ * @addtogroup Sim
+ * @{
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "Assert.h"
+
+void CheckAssert(bool condition)
+{
+	/* abort execution if condition is false, so it can be caught by debugger */
+	if (!condition) {
+		fprintf(stderr, "assertion failed\n");
+		abort();
+	}
+}
+
+/**
+ * @}
+ */
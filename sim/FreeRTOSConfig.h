@@ -0,0 +1,89 @@
+/*
+ * Host simulator FreeRTOS configuration. It mirrors src/FreeRTOSConfig.h,
+ * only port related settings differ.
+ */
+
+#ifndef FREERTOS_CONFIG_H
+#define FREERTOS_CONFIG_H
+
+/*-----------------------------------------------------------
+ * Application specific definitions.
+ *
+ * These definitions should be adjusted for your particular hardware and
+ * application requirements.
+ *
+ * THESE PARAMETERS ARE DESCRIBED WITHIN THE 'CONFIGURATION' SECTION OF THE
+ * FreeRTOS API DOCUMENTATION AVAILABLE ON THE FreeRTOS.org WEB SITE.
+ *
+ * See http://www.freertos.org/a00110.html.
+ *----------------------------------------------------------*/
+
+#include "Assert.h"
+
+#define configENABLE_BACKWARD_COMPATIBILITY 0
+
+#define configUSE_PREEMPTION		     1
+#define configUSE_IDLE_HOOK			     1 /* required by Posix port */
+#define configUSE_TICK_HOOK			     0
+#define configCHECK_FOR_STACK_OVERFLOW   0
+#define configUSE_MALLOC_FAILED_HOOK     0
+#define configSUPPORT_STATIC_ALLOCATION  1
+#define configSUPPORT_DYNAMIC_ALLOCATION 0
+
+#define configCPU_CLOCK_HZ			              1000000000UL
+#define configTICK_RATE_HZ			              1000
+#define configMAX_PRIORITIES		              3
+#define configMINIMAL_STACK_SIZE	              8192 /* host stack frames are much bigger */
+#define configTOTAL_HEAP_SIZE		              0
+#define configMAX_TASK_NAME_LEN		              8
+#define configUSE_TRACE_FACILITY	              0
+#define configUSE_16_BIT_TICKS		              0
+#define configIDLE_SHOULD_YIELD		              0
+#define configQUEUE_REGISTRY_SIZE	              0
+#define configUSE_MUTEXES                         0
+#define configUSE_COUNTING_SEMAPHORES             1
+#define configUSE_TASK_NOTIFICATIONS              1
+#define configUSE_QUEUE_SETS                      0
+#define configUSE_POSIX_ERRNO                     0
+#define configUSE_LIST_DATA_INTEGRITY_CHECK_BYTES 0
+
+/*
+ * Define to trap errors during development. Unlike on target, failed queue
+ * sends are not trapped, so overload can be observed in simulation.
+ */
+#define configASSERT Assert
+
+/* Co-routine definitions. */
+#define configUSE_CO_ROUTINES 		    0
+#define configMAX_CO_ROUTINE_PRIORITIES 2
+
+/* Software timer related definitions. */
+#define configUSE_TIMERS             0
+#define configTIMER_TASK_PRIORITY    2
+#define configTIMER_QUEUE_LENGTH     10
+#define configTIMER_TASK_STACK_DEPTH configMINIMAL_STACK_SIZE
+
+/* Set the following definitions to 1 to include the API function, or zero
+to exclude the API function. */
+#define INCLUDE_vTaskPrioritySet             0
+#define INCLUDE_uxTaskPriorityGet            0
+#define INCLUDE_vTaskDelete                  0
+#define INCLUDE_vTaskSuspend                 0
+#define INCLUDE_vTaskDelayUntil              0
+#define INCLUDE_vTaskDelay                   1
+#define INCLUDE_xTaskGetIdleTaskHandle       0
+#define INCLUDE_xTaskAbortDelay              0
+#define INCLUDE_xQueueGetMutexHolder         0
+#define INCLUDE_xSemaphoreGetMutexHolder     0
+#define INCLUDE_xTaskGetHandle               0
+#define INCLUDE_uxTaskGetStackHighWaterMark  0
+#define INCLUDE_uxTaskGetStackHighWaterMark2 0
+#define INCLUDE_eTaskGetState                0
+#define INCLUDE_xTaskResumeFromISR           0
+#define INCLUDE_xTimerPendFunctionCall       0
+#define INCLUDE_xTaskGetSchedulerState       0
+#define INCLUDE_xTaskGetCurrentTaskHandle    0
+
+#define ARRAY_SIZE(x) (sizeof(x) / sizeof(x[0]))
+
+#endif /* FREERTOS_CONFIG_H */
@@ -0,0 +1,548 @@
+/**
+ * @file bench.c
+ *
+ */
+
+/**
+ * @addtogroup Sim
+ * @{
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "block.h"
+#include "candrv.h"
+#include "FreeRTOS.h"
+#include "ground.h"
+#include "redundancy.h"
+#include "sim_trace.h"
+#include "soc.h"
+#include "task.h"
+#include "tctm.h"
+#include "vcan.h"
+
+/** maximum number of messages in one run */
+#define BENCH_MAX_MSGS 200000
+
+/** Ground station task priority */
+#define BENCH_PRIORITY (tskIDLE_PRIORITY + 1)
+
+/** how long to wait for outstanding replies after last request */
+#define BENCH_DRAIN_TIME pdMS_TO_TICKS(500)
+
+/** period of redundancy master keep-alive sent by ground station */
+#define BENCH_KEEPALIVE_PERIOD 1000000000ULL
+
+/** last sequence number of Get Block window, whole 256 byte memory of block handler */
+#define BENCH_GB_MAX_SEQ 31
+
+/**
+ * @enum bench_stage
+ * @brief Timestamps recorded for each message
+ */
+enum bench_stage {
+	bench_stage_sent = 0, /**< request passed to ground station driver */
+	bench_stage_rx_isr, /**< request received in node CAN ISR */
+	bench_stage_dispatch, /**< request taken from dispatcher queue */
+	bench_stage_done, /**< TC/TM handler returned */
+	bench_stage_send, /**< reply passed to cants_send_msg() */
+	bench_stage_acked, /**< reply received by ground station */
+	bench_stage_count,
+};
+/**
+ *@}
+ */
+
+/**
+ * @struct bench_record
+ * @brief Timestamps of one request/reply round trip
+ */
+struct bench_record {
+	uint64_t t[bench_stage_count]; /**< timestamps in ns, 0 if not reached */
+	uint8_t nack; /**< set if request was nacked */
+};
+/**
+ *@}
+ */
+
+/**
+ * @struct bench_cfg
+ * @brief Benchmark run configuration
+ */
+struct bench_cfg {
+	uint8_t type; /**< ::cants_type_telecommand, ::cants_type_telemetry or ::cants_type_get_block */
+	uint32_t count; /**< number of requests, or Get Block windows */
+	uint32_t rate; /**< requests per second, 0 means closed loop */
+	uint32_t window; /**< maximum number of outstanding requests, 0 means unlimited */
+	uint8_t line_rate; /**< non-zero if virtual bus runs at configured baud rate */
+};
+/**
+ *@}
+ */
+
+/* CAN interrupt handlers in candrv.c */
+void can0_handler(void);
+void can1_handler(void);
+
+/* idle task related variables */
+static StaticTask_t xIdleTaskTCB;
+static StackType_t uxIdleTaskStack[configMINIMAL_STACK_SIZE];
+
+/* benchmark task related variables */
+static StaticTask_t bench_task_buffer;
+static StackType_t bench_task_stack[configMINIMAL_STACK_SIZE];
+
+static struct bench_cfg cfg = { cants_type_telecommand, 10000, 0, 4, 1 };
+static struct bench_record records[BENCH_MAX_MSGS];
+
+/** last record index seen at each stage, used to unwrap 8-bit channel numbers */
+static uint32_t last_index[bench_stage_count];
+
+/** run time of benchmark in ns */
+static uint64_t elapsed;
+
+void vApplicationGetIdleTaskMemory(StaticTask_t **ppxIdleTaskTCBBuffer,
+                                   StackType_t **ppxIdleTaskStackBuffer,
+                                   uint32_t *pulIdleTaskStackSize)
+{
+    *ppxIdleTaskTCBBuffer = &xIdleTaskTCB;
+    *ppxIdleTaskStackBuffer = uxIdleTaskStack;
+    *pulIdleTaskStackSize = configMINIMAL_STACK_SIZE;
+}
+
+uint8_t cants_telecommand_handler(uint8_t channel, uint8_t length, uint8_t *data)
+{
+	/* accept every telecommand */
+	(void)channel;
+	(void)length;
+	(void)data;
+
+	return 1;
+}
+
+uint8_t cants_telemetry_handler(uint8_t channel, uint8_t *length, uint8_t *data)
+{
+	/* every channel returns 4 bytes */
+	memset(data, channel, 4);
+	*length = 4;
+
+	return 1;
+}
+
+/**
+ * @brief Record timestamp of benchmarked message
+ * @param [in] stage one of ::bench_stage
+ * @param [in] msg message, its channel is the low byte of request index
+ * @retval None
+ */
+static void bench_stamp(uint8_t stage, struct cants_msg *msg)
+{
+	uint64_t now = ullPortGetTimeNs();
+	uint32_t index;
+
+	/*
+	 * Requests are processed in order, so index can be unwrapped from 8-bit
+	 * channel, as long as less than 128 consecutive requests get lost.
+	 */
+	index = last_index[stage] + (int8_t)((uint8_t)cants_msg_cmd(msg) - (uint8_t)last_index[stage]);
+	last_index[stage] = index;
+
+	if (index < cfg.count && !records[index].t[stage])
+		records[index].t[stage] = now;
+}
+
+/**
+ * @brief Tracing hook called by CAN-TS stack
+ * @param [in] point one of ::cants_trace_point
+ * @param [in] msg traced message
+ * @retval None
+ */
+static void bench_trace(uint8_t point, struct cants_msg *msg)
+{
+	static const uint8_t stages[] = {
+		[cants_trace_rx_isr] = bench_stage_rx_isr,
+		[cants_trace_dispatch] = bench_stage_dispatch,
+		[cants_trace_tc_done] = bench_stage_done,
+		[cants_trace_tm_done] = bench_stage_done,
+		[cants_trace_send] = bench_stage_send,
+	};
+
+	if (cants_msg_type(msg) != cfg.type || point >= ARRAY_SIZE(stages))
+		return;
+
+	/* requests come from ground station, replies go to it */
+	if ((point == cants_trace_send) ? cants_msg_dst(msg) != GROUND_ID : cants_msg_src(msg) != GROUND_ID)
+		return;
+
+	bench_stamp(stages[point], msg);
+}
+
+/**
+ * @brief Send redundancy master keep-alive, so the node stays on primary bus
+ * @retval None
+ */
+static void bench_keepalive(void)
+{
+	struct cants_msg msg;
+
+	cants_msg_set_id(&msg, CANTS_KEEPALIVE_ID, cants_type_unsolicited_tm, REDUNDANCY_MASTER_ID, 0);
+	msg.length = 0;
+	ground_send(&msg, portMAX_DELAY);
+}
+
+/**
+ * @brief Benchmark task, sends requests and collects replies
+ * @param [in] arg ignored
+ * @retval None
+ */
+static void bench_task(void *arg)
+{
+	uint64_t start, now, next_keepalive = 0;
+	uint32_t sent = 0, replied = 0;
+	struct cants_msg msg;
+	TickType_t wait;
+
+	(void)arg;
+
+	bench_keepalive();
+	start = ullPortGetTimeNs();
+
+	while (replied < cfg.count) {
+		now = ullPortGetTimeNs();
+
+		if (now >= next_keepalive) {
+			bench_keepalive();
+			next_keepalive = now + BENCH_KEEPALIVE_PERIOD;
+		}
+
+		/* send all requests which are due and fit into the window */
+		while (sent < cfg.count && (!cfg.window || sent - replied < cfg.window) &&
+			(!cfg.rate || now - start >= (uint64_t)sent * 1000000000ULL / cfg.rate)) {
+			cants_msg_set_id(&msg, CANTS_NODE_ID, cfg.type, GROUND_ID, TCTM_RA_REQUEST | (sent & 0xff));
+			msg.length = cfg.type == cants_type_telecommand ? 4 : 0;
+			memcpy(msg.data, &sent, sizeof(sent));
+
+			records[sent].t[bench_stage_sent] = now;
+			ground_send(&msg, portMAX_DELAY);
+			sent++;
+		}
+
+		/* wait for reply until next request is due */
+		wait = (sent == cfg.count) ? BENCH_DRAIN_TIME : 1;
+		if (!ground_recv(&msg, wait)) {
+			if (sent == cfg.count)
+				break;
+			continue;
+		}
+
+		if (cants_msg_type(&msg) != cfg.type || cants_msg_src(&msg) != CANTS_NODE_ID ||
+			cants_msg_dst(&msg) != GROUND_ID)
+			continue;
+
+		/* index can't be unwrapped reliably, when too many consecutive requests got lost */
+		bench_stamp(bench_stage_acked, &msg);
+		if (last_index[bench_stage_acked] < cfg.count)
+			records[last_index[bench_stage_acked]].nack = (cants_msg_cmd(&msg) & TCTM_RA_MASK) != TCTM_RA_ACK;
+		replied++;
+	}
+
+	elapsed = ullPortGetTimeNs() - start;
+	vTaskEndScheduler();
+}
+
+/**
+ * @brief Wait for Get Block reply from node
+ * @param [out] msg received message
+ * @retval 1 if reply was received, 0 on timeout
+ */
+static uint8_t bench_gb_reply(struct cants_msg *msg)
+{
+	while (ground_recv(msg, BENCH_DRAIN_TIME))
+		if (cants_msg_type(msg) == cants_type_get_block && cants_msg_src(msg) == CANTS_NODE_ID &&
+			cants_msg_dst(msg) == GROUND_ID)
+			return 1;
+
+	return 0;
+}
+
+/**
+ * @brief Get Block benchmark task, reads the same window repeatedly with START
+ * requests and times transmission of each window
+ * @param [in] arg ignored
+ * @retval None
+ */
+static void bench_gb_task(void *arg)
+{
+	uint8_t address = 0, mask[(BENCH_GB_MAX_SEQ + 8) / 8], frames;
+	uint64_t start, now, next_keepalive = 0;
+	struct cants_msg msg;
+	uint32_t i;
+
+	(void)arg;
+
+	memset(mask, 0xff, sizeof(mask));
+	bench_keepalive();
+	start = ullPortGetTimeNs();
+
+	cants_msg_set_id(&msg, CANTS_NODE_ID, cants_type_get_block, GROUND_ID,
+			(BLOCK_RA_REQUEST << BLOCK_RA_SHIFT) | BENCH_GB_MAX_SEQ);
+	msg.length = 1;
+	msg.data[0] = address;
+	ground_send(&msg, portMAX_DELAY);
+
+	if (!bench_gb_reply(&msg) || cants_msg_cmd(&msg) >> BLOCK_RA_SHIFT != BLOCK_RA_ACK)
+		goto end;
+
+	for (i = 0; i < cfg.count; i++) {
+		now = ullPortGetTimeNs();
+		if (now >= next_keepalive) {
+			bench_keepalive();
+			next_keepalive = now + BENCH_KEEPALIVE_PERIOD;
+		}
+
+		cants_msg_set_id(&msg, CANTS_NODE_ID, cants_type_get_block, GROUND_ID,
+				BLOCK_RA_GB_START << BLOCK_RA_SHIFT);
+		msg.length = sizeof(mask);
+		memcpy(msg.data, mask, sizeof(mask));
+		records[i].t[bench_stage_sent] = now;
+		ground_send(&msg, portMAX_DELAY);
+
+		/* window is complete when last frame arrives, missing frames are counted as nack */
+		for (frames = 0; frames <= BENCH_GB_MAX_SEQ; frames++) {
+			if (!bench_gb_reply(&msg) ||
+				cants_msg_cmd(&msg) != ((BLOCK_RA_GB_TRANSFER << BLOCK_RA_SHIFT) | frames))
+				break;
+		}
+		records[i].t[bench_stage_acked] = ullPortGetTimeNs();
+		records[i].nack = frames <= BENCH_GB_MAX_SEQ;
+		if (records[i].nack)
+			break;
+	}
+
+	cants_msg_set_id(&msg, CANTS_NODE_ID, cants_type_get_block, GROUND_ID, BLOCK_RA_ABORT << BLOCK_RA_SHIFT);
+	msg.length = 0;
+	ground_send(&msg, portMAX_DELAY);
+
+end:
+	elapsed = ullPortGetTimeNs() - start;
+	vTaskEndScheduler();
+}
+
+/**
+ * @brief Compare function for qsort
+ */
+static int bench_cmp(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+/**
+ * @brief Print latency statistics between two stages
+ * @param [in] name segment description
+ * @param [in] from start stage
+ * @param [in] to end stage
+ * @param [in] histogram non-zero to print log2 histogram
+ * @retval 99th percentile in ns
+ */
+static uint64_t bench_report_segment(const char *name, uint8_t from, uint8_t to, uint8_t histogram)
+{
+	uint64_t *d = malloc(cfg.count * sizeof(*d)), p99;
+	uint32_t i, n = 0, buckets[32] = { 0 };
+
+	for (i = 0; i < cfg.count; i++)
+		if (records[i].t[from] && records[i].t[to] && records[i].t[to] >= records[i].t[from])
+			d[n++] = records[i].t[to] - records[i].t[from];
+
+	if (!n) {
+		printf("%-22s no samples\n", name);
+		free(d);
+		return 0;
+	}
+
+	qsort(d, n, sizeof(*d), bench_cmp);
+	p99 = d[(uint64_t)n * 99 / 100];
+	printf("%-22s n=%-7u min=%8.1f p50=%8.1f p90=%8.1f p99=%8.1f max=%8.1f us\n", name, n,
+			d[0] / 1e3, d[n / 2] / 1e3, d[(uint64_t)n * 90 / 100] / 1e3, p99 / 1e3, d[n - 1] / 1e3);
+
+	if (histogram) {
+		for (i = 0; i < n; i++) {
+			uint8_t b = 0;
+			uint64_t us = d[i] / 1000;
+
+			while (us && b < 31) {
+				us >>= 1;
+				b++;
+			}
+			buckets[b]++;
+		}
+		for (i = 0; i < 32; i++)
+			if (buckets[i])
+				printf("  < %8u us: %u\n", 1U << i, buckets[i]);
+	}
+
+	free(d);
+	return p99;
+}
+
+/**
+ * @brief Print benchmark results
+ * @retval None
+ */
+static void bench_report(void)
+{
+	uint32_t i, acked = 0, nacked = 0;
+	struct vcan_bus_stats bus;
+	struct candrv_stats tx;
+	struct cants_stats rx;
+	uint64_t p99;
+	double thr;
+
+	for (i = 0; i < cfg.count; i++) {
+		if (!records[i].t[bench_stage_acked])
+			continue;
+		if (records[i].nack)
+			nacked++;
+		else
+			acked++;
+	}
+	vcan_get_stats(0, &bus);
+	candrv_get_stats(&tx);
+	cants_get_stats(&rx);
+
+	if (cfg.type == cants_type_get_block) {
+		thr = elapsed ? acked * (BENCH_GB_MAX_SEQ + 1) * 8 * 1e9 / elapsed : 0;
+
+		printf("GB: %u windows of %u bytes, bus %s\n", cfg.count, (BENCH_GB_MAX_SEQ + 1) * 8,
+				cfg.line_rate ? "1 Mbit/s" : "unlimited");
+		printf("complete %u, incomplete %u, elapsed %.3f s, throughput %.0f bytes/s\n",
+				acked, nacked, elapsed / 1e9, thr);
+		printf("bus frames %u, dropped in RX FIFO %u, in dispatcher ring %u, utilization %.1f %%\n", bus.frames,
+				bus.lost, rx.rx_overflow, elapsed ? bus.busy_ns * 100.0 / elapsed : 0);
+		printf("node TX direct %u, queued %u, dropped %u, queue high-water mark %u/%u\n",
+				tx.tx_direct, tx.tx_queued, tx.tx_dropped, tx.tx_queue_hwm, CAN_SEND_QUEUE_LEN);
+		printf("node RX overruns %u/%u, no message %u, shed bulk %u, control %u, essential %u\n",
+				tx.rx_overrun[0], tx.rx_overrun[1], tx.rx_no_msg, rx.rx_shed[cants_rx_bulk],
+				rx.rx_shed[cants_rx_control], rx.rx_shed[cants_rx_essential]);
+		printf("node GB nacked by dispatcher %u, dropped over dispatcher quota %u\n",
+				rx.rx_nack[cants_type_get_block], rx.rx_dropped[cants_type_get_block]);
+		p99 = bench_report_segment("window", bench_stage_sent, bench_stage_acked, 1);
+
+		printf("BENCH type=gb throughput=%.0f incomplete=%u tx_dropped=%u p99_us=%.1f\n",
+				thr, nacked, tx.tx_dropped, p99 / 1e3);
+		return;
+	}
+
+	thr = elapsed ? acked * 1e9 / elapsed : 0;
+
+	printf("%s: %u requests, rate %u/s, window %u, bus %s\n",
+			cfg.type == cants_type_telecommand ? "TC" : "TM", cfg.count, cfg.rate, cfg.window,
+			cfg.line_rate ? "1 Mbit/s" : "unlimited");
+	printf("acked %u, nacked %u, lost %u, elapsed %.3f s, throughput %.0f acks/s\n",
+			acked, nacked, cfg.count - acked - nacked, elapsed / 1e9, thr);
+	printf("bus frames %u, dropped in RX FIFO %u, in dispatcher ring %u, utilization %.1f %%\n", bus.frames,
+			bus.lost, rx.rx_overflow, elapsed ? bus.busy_ns * 100.0 / elapsed : 0);
+	printf("node TX direct %u, queued %u, dropped %u, queue high-water mark %u/%u\n",
+			tx.tx_direct, tx.tx_queued, tx.tx_dropped, tx.tx_queue_hwm, CAN_SEND_QUEUE_LEN);
+	printf("node RX overruns %u/%u, no message %u, shed bulk %u, control %u, essential %u\n",
+			tx.rx_overrun[0], tx.rx_overrun[1], tx.rx_no_msg, rx.rx_shed[cants_rx_bulk],
+			rx.rx_shed[cants_rx_control], rx.rx_shed[cants_rx_essential]);
+	printf("node %s nacked by dispatcher %u, dropped over dispatcher quota %u\n",
+			cfg.type == cants_type_telecommand ? "TC" : "TM", rx.rx_nack[cfg.type], rx.rx_dropped[cfg.type]);
+
+	bench_report_segment("request on bus", bench_stage_sent, bench_stage_rx_isr, 0);
+	bench_report_segment("ISR -> dispatcher", bench_stage_rx_isr, bench_stage_dispatch, 0);
+	bench_report_segment("dispatcher -> handler", bench_stage_dispatch, bench_stage_done, 0);
+	bench_report_segment("handler -> send", bench_stage_done, bench_stage_send, 0);
+	bench_report_segment("send -> ground", bench_stage_send, bench_stage_acked, 0);
+	bench_report_segment("ISR -> send", bench_stage_rx_isr, bench_stage_send, 0);
+	p99 = bench_report_segment("round trip", bench_stage_sent, bench_stage_acked, 1);
+
+	/* single line summary for tracking results between commits */
+	printf("BENCH type=%s rate=%u window=%u throughput=%.0f nacked=%u lost=%u p99_us=%.1f\n",
+			cfg.type == cants_type_telecommand ? "tc" : "tm", cfg.rate, cfg.window, thr,
+			nacked, cfg.count - acked - nacked, p99 / 1e3);
+}
+
+/**
+ * @brief Print usage
+ * @param [in] name program name
+ * @retval None
+ */
+static void bench_usage(const char *name)
+{
+	printf("usage: %s [-t tc|tm|gb] [-n count] [-r rate] [-w window] [-i]\n"
+		   "  -t  request type, gb reads 256 byte Get Block windows (default tc)\n"
+		   "  -n  number of requests or windows (default 10000)\n"
+		   "  -r  requests per second, 0 is closed loop (default 0)\n"
+		   "  -w  maximum outstanding requests, 0 is unlimited (default 4, unlimited with -r)\n"
+		   "  -i  infinitely fast bus instead of 1 Mbit/s\n", name);
+}
+
+int main(int argc, char *argv[])
+{
+	int opt, window = -1;
+
+	while ((opt = getopt(argc, argv, "t:n:r:w:ih")) != -1) {
+		switch (opt) {
+		case 't':
+			if (!strcmp(optarg, "gb"))
+				cfg.type = cants_type_get_block;
+			else
+				cfg.type = strcmp(optarg, "tm") ? cants_type_telecommand : cants_type_telemetry;
+			break;
+		case 'n':
+			cfg.count = strtoul(optarg, NULL, 0);
+			break;
+		case 'r':
+			cfg.rate = strtoul(optarg, NULL, 0);
+			break;
+		case 'w':
+			window = atoi(optarg);
+			break;
+		case 'i':
+			cfg.line_rate = 0;
+			break;
+		default:
+			bench_usage(argv[0]);
+			return 2;
+		}
+	}
+
+	if (!cfg.count || cfg.count > BENCH_MAX_MSGS) {
+		printf("count must be between 1 and %u\n", BENCH_MAX_MSGS);
+		return 2;
+	}
+	if (window >= 0)
+		cfg.window = window;
+	else if (cfg.rate)
+		cfg.window = 0;
+
+	/* connect node and ground station to virtual busses */
+	vcan_init(cfg.line_rate);
+	vcan_attach(CAN0, 0, can0_handler);
+	vcan_attach(CAN1, 1, can1_handler);
+	ground_init();
+	/* Get Block windows are timed by benchmark task alone */
+	if (cfg.type != cants_type_get_block)
+		sim_trace_hook = bench_trace;
+
+	candrv_init();
+
+	xTaskCreateStatic(cfg.type == cants_type_get_block ? bench_gb_task : bench_task, "BENCH", ARRAY_SIZE(bench_task_stack),
+			NULL, BENCH_PRIORITY, bench_task_stack, &bench_task_buffer);
+
+	vTaskStartScheduler();
+
+	bench_report();
+
+	return 0;
+}
+
+/**
+ * @}
+ */
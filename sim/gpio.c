@@ -0,0 +1,99 @@
+/**
+ * @file gpio.c
+ *
+ */
+
+/**
+ * @addtogroup Sim
+ * @{
+ */
+
+#include "gpio.h"
+#include "soc.h"
+
+/**
+ * @struct vgpio
+ * @brief State of virtual GPIO port
+ */
+struct vgpio {
+	struct gpio *base; /**< handle used by GPIO driver API */
+	uint8_t ddr; /**< direction register */
+	uint8_t out; /**< output register */
+};
+/**
+ *@}
+ */
+
+static struct vgpio ports[] = {
+	{ GPIO0, 0, 0 },
+	{ GPIO1, 0, 0 },
+	{ GPIO2, 0, 0 },
+	{ GPIO3, 0, 0 },
+	{ GPIO4, 0, 0 },
+	{ GPIO5, 0, 0 },
+};
+
+/**
+ * @brief Find port state by its handle
+ * @param [in] base port handle
+ * @retval port state
+ */
+static struct vgpio *vgpio_port(struct gpio *base)
+{
+	uint8_t i;
+
+	for (i = 0; i < sizeof(ports) / sizeof(ports[0]); i++)
+		if (ports[i].base == base)
+			return &ports[i];
+
+	return &ports[0];
+}
+
+void gpio_set_direction(struct gpio *base, uint8_t pins, uint8_t direction)
+{
+	struct vgpio *port = vgpio_port(base);
+
+	if (direction == GPIO_DIR_OUT)
+		port->ddr |= pins;
+	else
+		port->ddr &= ~pins;
+}
+
+void gpio_set_port(struct gpio *base, uint8_t state)
+{
+	vgpio_port(base)->out = state;
+}
+
+void gpio_set_pins(struct gpio *base, uint8_t pins)
+{
+	vgpio_port(base)->out |= pins;
+}
+
+void gpio_clr_pins(struct gpio *base, uint8_t pins)
+{
+	vgpio_port(base)->out &= ~pins;
+}
+
+uint8_t gpio_get_port(struct gpio *base)
+{
+	/* inputs are not driven, output pins read back their state */
+	struct vgpio *port = vgpio_port(base);
+
+	return port->out & port->ddr;
+}
+
+bool gpio_get_pin(struct gpio *base, uint8_t pin)
+{
+	return !!(gpio_get_port(base) & pin);
+}
+
+void gpio_set_function(struct gpio *base, uint8_t pin, uint8_t function)
+{
+	(void)base;
+	(void)pin;
+	(void)function;
+}
+
+/**
+ * @}
+ */
@@ -0,0 +1,135 @@
+/**
+ * @file ground.c
+ *
+ */
+
+/**
+ * @addtogroup Sim
+ * @{
+ */
+
+#include "can.h"
+#include "ground.h"
+#include "queue.h"
+#include "vcan.h"
+
+/* ground station queues */
+static QueueHandle_t ground_rx_queue = NULL;
+static StaticQueue_t ground_rx_queue_struct;
+static uint8_t ground_rx_queue_buffer[GROUND_QUEUE_LEN * sizeof(struct cants_msg)];
+
+static QueueHandle_t ground_tx_queue = NULL;
+static StaticQueue_t ground_tx_queue_struct;
+static uint8_t ground_tx_queue_buffer[GROUND_QUEUE_LEN * sizeof(struct cants_msg)];
+
+/* controller used for transmission */
+static struct can *tx_ctrl = GROUND_CAN0;
+
+/**
+ * @brief Ground station controller interrupt handler
+ * @param [in] base controller which raised interrupt
+ * @retval None
+ */
+static void ground_int_handler(struct can *base)
+{
+	uint8_t ir = can_get_int_status(base);
+	BaseType_t yield = pdFALSE;
+	struct cants_msg msg;
+
+	if (base == tx_ctrl && (ir & CAN_IRQ_TI)) {
+		if (xQueueReceiveFromISR(ground_tx_queue, &msg, &yield) == pdTRUE)
+			can_send_packet(base, cants_construct_id(&msg), msg.length, msg.data, 0, true);
+	}
+
+	if (ir & CAN_IRQ_RI) {
+		bool ext, rtr;
+		uint32_t id;
+
+		while (can_get_status(base) & CAN_SR_RBS) {
+			can_recv_packet(base, &id, &msg.length, msg.data, &rtr, &ext);
+			if (ext && !rtr) {
+				cants_parse_id(&msg, id);
+				xQueueSendToBackFromISR(ground_rx_queue, &msg, &yield);
+			}
+		}
+	}
+
+	portEND_SWITCHING_ISR(yield);
+}
+
+/**
+ * @brief Interrupt handler of ground station controller on primary bus
+ * @retval None
+ */
+static void ground_can0_handler(void)
+{
+	ground_int_handler(GROUND_CAN0);
+}
+
+/**
+ * @brief Interrupt handler of ground station controller on secondary bus
+ * @retval None
+ */
+static void ground_can1_handler(void)
+{
+	ground_int_handler(GROUND_CAN1);
+}
+
+/**
+ * @brief Configure ground station controller
+ * @param [in] base controller handle
+ * @retval None
+ */
+static void ground_init_ctrl(struct can *base)
+{
+	can_reset_mode(base, true);
+	can_set_baudrate(base, 1000000, 0);
+	/* receive everything */
+	can_set_rx_filter(base, 0, 0, true);
+	can_enable_interrupt(base, CAN_IRQ_RI | CAN_IRQ_TI, true);
+	can_reset_mode(base, false);
+}
+
+void ground_init(void)
+{
+	ground_rx_queue = xQueueCreateStatic(GROUND_QUEUE_LEN, sizeof(struct cants_msg),
+			ground_rx_queue_buffer, &ground_rx_queue_struct);
+	ground_tx_queue = xQueueCreateStatic(GROUND_QUEUE_LEN, sizeof(struct cants_msg),
+			ground_tx_queue_buffer, &ground_tx_queue_struct);
+
+	vcan_attach(GROUND_CAN0, 0, ground_can0_handler);
+	vcan_attach(GROUND_CAN1, 1, ground_can1_handler);
+	ground_init_ctrl(GROUND_CAN0);
+	ground_init_ctrl(GROUND_CAN1);
+}
+
+void ground_set_bus(uint8_t bus)
+{
+	taskENTER_CRITICAL();
+	tx_ctrl = bus ? GROUND_CAN1 : GROUND_CAN0;
+	taskEXIT_CRITICAL();
+}
+
+uint8_t ground_send(struct cants_msg *msg, TickType_t wait)
+{
+	uint8_t ret = 1;
+
+	/* same scheme as cants_send_msg() in candrv.c */
+	taskENTER_CRITICAL();
+	if ((can_get_status(tx_ctrl) & CAN_SR_TBS) && !uxQueueMessagesWaiting(ground_tx_queue))
+		can_send_packet(tx_ctrl, cants_construct_id(msg), msg->length, msg->data, 0, true);
+	else if (xQueueSendToBack(ground_tx_queue, msg, wait) == errQUEUE_FULL)
+		ret = 0;
+	taskEXIT_CRITICAL();
+
+	return ret;
+}
+
+uint8_t ground_recv(struct cants_msg *msg, TickType_t wait)
+{
+	return xQueueReceive(ground_rx_queue, msg, wait) == pdTRUE;
+}
+
+/**
+ * @}
+ */
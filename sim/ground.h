@@ -0,0 +1,60 @@
+/**
+ * @file ground.h
+ *
+ */
+
+/**
+ * @addtogroup Sim
+ * @{
+ */
+
+#ifndef GROUND_H_
+#define GROUND_H_
+
+#include "cants.h"
+#include "FreeRTOS.h"
+
+/** Node ID used by simulated ground station */
+#define GROUND_ID 0x10
+
+/** Virtual controller handles of ground station, one per bus */
+#define GROUND_CAN0 ((struct can *)(0x400))
+#define GROUND_CAN1 ((struct can *)(0x420))
+
+/** length of ground station RX and TX queues */
+#define GROUND_QUEUE_LEN 128
+
+/**
+ * @brief Attach ground station to both virtual busses
+ * @retval None
+ */
+void ground_init(void);
+
+/**
+ * @brief Select bus on which ground station sends frames
+ * @param [in] bus bus index
+ * @retval None
+ */
+void ground_set_bus(uint8_t bus);
+
+/**
+ * @brief Send CAN-TS message from ground station
+ * @param [in] msg message to send
+ * @param [in] wait maximum time to wait for space in TX queue
+ * @retval 0 if message could not be queued, any other value means success
+ */
+uint8_t ground_send(struct cants_msg *msg, TickType_t wait);
+
+/**
+ * @brief Receive CAN-TS message from any bus
+ * @param [out] msg received message
+ * @param [in] wait maximum time to wait for message
+ * @retval 0 if no message was received, any other value means success
+ */
+uint8_t ground_recv(struct cants_msg *msg, TickType_t wait);
+
+#endif
+
+/**
+ * @}
+ */
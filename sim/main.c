@@ -0,0 +1,849 @@
+/**
+ * @file main.c
+ *
+ */
+
+/**
+ * @addtogroup Sim
+ * @{
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "block.h"
+#include "candrv.h"
+#include "FreeRTOS.h"
+#include "ground.h"
+#include "gpio.h"
+#include "redundancy.h"
+#include "sctime.h"
+#include "sim_trace.h"
+#include "soc.h"
+#include "task.h"
+#include "tctm.h"
+#include "telecommands.h"
+#include "telemetry.h"
+#include "vcan.h"
+
+/** Ground station task priority */
+#define GROUND_PRIORITY (tskIDLE_PRIORITY + 1)
+
+/** how long to wait for reply from node */
+#define REPLY_TIMEOUT pdMS_TO_TICKS(100)
+
+/** drift of simulated spacecraft clock against host clock, in ppm */
+#define SYNC_DRIFT_PPM 200
+
+/** spacecraft time at start of simulation, in seconds */
+#define SYNC_EPOCH 700000000ULL
+
+/** number of Time Sync frames sent by ground station */
+#define SYNC_COUNT 20
+
+/** interval between Time Sync frames in ms */
+#define SYNC_INTERVAL 200
+
+/** first of source IDs, which ground station uses to open more block transfer sessions */
+#define ARENA_SOURCE 0x20
+
+/** frames sent over what their task queue with ISR routing and their share of dispatcher ring take */
+#define OVERLOAD_EXTRA 4
+
+/* CAN interrupt handlers in candrv.c */
+void can0_handler(void);
+void can1_handler(void);
+
+/* idle task related variables */
+static StaticTask_t xIdleTaskTCB;
+static StackType_t uxIdleTaskStack[configMINIMAL_STACK_SIZE];
+
+/* ground station task related variables */
+static StaticTask_t ground_task_buffer;
+static StackType_t ground_task_stack[configMINIMAL_STACK_SIZE];
+
+/* slow reader task related variables */
+static StaticTask_t reader_task_buffer;
+static StackType_t reader_task_stack[configMINIMAL_STACK_SIZE];
+static TaskHandle_t reader_task;
+
+/** number of failed checks */
+static unsigned failures;
+
+/** host time of tick 0, base of frame reception timestamps */
+static uint64_t start_ns;
+
+/** biggest difference between frame reception timestamp and host time in us */
+static uint32_t rx_time_error;
+
+/** number of frames with reception timestamp going backwards */
+static unsigned rx_time_reversed;
+
+/** number of cants_read_block_handler() calls made by the stack */
+static unsigned gb_reads;
+
+/** delay of next Get Block read, which is then finished by reader task, 0 to finish reads at once */
+static TickType_t gb_read_delay;
+
+/** done flag of read in progress, set by reader task */
+static uint8_t *gb_read_done;
+
+/** source ID of frames sent by ground station, replies to it are expected */
+static uint8_t ground_src = GROUND_ID;
+
+void vApplicationGetIdleTaskMemory(StaticTask_t **ppxIdleTaskTCBBuffer,
+                                   StackType_t **ppxIdleTaskStackBuffer,
+                                   uint32_t *pulIdleTaskStackSize)
+{
+    *ppxIdleTaskTCBBuffer = &xIdleTaskTCB;
+    *ppxIdleTaskStackBuffer = uxIdleTaskStack;
+    *pulIdleTaskStackSize = configMINIMAL_STACK_SIZE;
+}
+
+/* handler in block_handler.c, stack calls it through wrapper below */
+uint8_t __real_cants_read_block_handler(ADDRESS_TYPE address, uint8_t *buffer, uint16_t size, uint8_t *done);
+
+/**
+ * @brief Count Get Block reads. Stack's calls of cants_read_block_handler() are linked here with --wrap.
+ * @param [in] address source address
+ * @param [out] buffer read data
+ * @param [in] size number of bytes to read
+ * @param [out] done set when reading finishes
+ * @retval return value of the handler
+ */
+uint8_t __wrap_cants_read_block_handler(ADDRESS_TYPE address, uint8_t *buffer, uint16_t size, uint8_t *done)
+{
+	uint8_t ret, sync_done;
+
+	gb_reads++;
+
+	/* data is copied at once, but done flag is set by reader task, like slow device would do */
+	if (!gb_read_delay || gb_read_done)
+		return __real_cants_read_block_handler(address, buffer, size, done);
+
+	ret = __real_cants_read_block_handler(address, buffer, size, &sync_done);
+	if (ret) {
+		*done = 0;
+		gb_read_done = done;
+		xTaskNotifyGive(reader_task);
+	}
+
+	return ret;
+}
+
+/**
+ * @brief Slow reader task, finishes delayed Get Block read
+ * @param [in] arg ignored
+ * @retval None
+ */
+static void reader(void *arg)
+{
+	(void)arg;
+
+	while (1) {
+		ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+		vTaskDelay(gb_read_delay);
+
+		/* only one read is delayed */
+		taskENTER_CRITICAL();
+		*gb_read_done = 1;
+		gb_read_done = NULL;
+		gb_read_delay = 0;
+		taskEXIT_CRITICAL();
+	}
+}
+
+/**
+ * @brief Report result of a check
+ * @param [in] name check description
+ * @param [in] ok result of the check
+ * @retval None
+ */
+static void check(const char *name, int ok)
+{
+	printf("%-40s %s\n", name, ok ? "OK" : "FAILED");
+	if (!ok)
+		failures++;
+}
+
+/**
+ * @brief Trace hook, compares reception timestamps of received frames with host time
+ * @param [in] point one of ::cants_trace_point
+ * @param [in] msg traced message
+ * @retval None
+ */
+static void rx_time_trace(uint8_t point, struct cants_msg *msg)
+{
+	static uint32_t last;
+	uint32_t time = cants_msg_time(msg);
+	int64_t error;
+
+	if (point != cants_trace_rx_isr)
+		return;
+
+	error = (int64_t)((ullPortGetTimeNs() - start_ns) / 1000) - time;
+	if (error < 0)
+		error = -error;
+	if (error > rx_time_error)
+		rx_time_error = error;
+	if (time < last)
+		rx_time_reversed++;
+	last = time;
+}
+
+/**
+ * @brief Prepare message from ground station to the node
+ * @param [out] msg message
+ * @param [in] type CAN-TS transfer type
+ * @param [in] command CAN-TS command field
+ * @param [in] length data length
+ * @param [in] data message data, may be NULL if length is 0
+ * @retval None
+ */
+static void ground_msg(struct cants_msg *msg, uint8_t type, uint16_t command,
+		uint8_t length, const uint8_t *data)
+{
+	cants_msg_set_id(msg, CANTS_NODE_ID, type, ground_src, command);
+	msg->length = length;
+	if (length)
+		memcpy(msg->data, data, length);
+}
+
+/**
+ * @brief Wait for reply of given type from the node, ignoring keep-alive messages
+ * @param [out] msg received message
+ * @param [in] type expected CAN-TS transfer type
+ * @retval 0 on timeout, any other value means success
+ */
+static uint8_t ground_reply(struct cants_msg *msg, uint8_t type)
+{
+	while (ground_recv(msg, REPLY_TIMEOUT))
+		if (cants_msg_type(msg) == type && cants_msg_src(msg) == CANTS_NODE_ID &&
+			cants_msg_dst(msg) == ground_src)
+			return 1;
+
+	return 0;
+}
+
+/**
+ * @brief Send redundancy master keep-alive, which keeps node on current bus
+ * @retval None
+ */
+static void ground_master_keepalive(void)
+{
+	struct cants_msg msg;
+
+	cants_msg_set_id(&msg, CANTS_KEEPALIVE_ID, cants_type_unsolicited_tm, REDUNDANCY_MASTER_ID, 0);
+	msg.length = 0;
+	ground_send(&msg, portMAX_DELAY);
+}
+
+/**
+ * @brief Exercise telecommand and telemetry transfers
+ * @retval None
+ */
+static void ground_tctm(void)
+{
+	const uint8_t leds = 0x5a;
+	struct cants_msg msg;
+
+	ground_msg(&msg, cants_type_telecommand, TC_SET_LED, 1, &leds);
+	ground_send(&msg, portMAX_DELAY);
+	check("TC set LEDs acked", ground_reply(&msg, cants_type_telecommand) &&
+			(cants_msg_cmd(&msg) & TCTM_RA_MASK) == TCTM_RA_ACK && msg.length == 0);
+
+	ground_msg(&msg, cants_type_telecommand, 0x55, 1, &leds);
+	ground_send(&msg, portMAX_DELAY);
+	check("TC unknown channel nacked", ground_reply(&msg, cants_type_telecommand) &&
+			(cants_msg_cmd(&msg) & TCTM_RA_MASK) == TCTM_RA_NACK);
+
+	ground_msg(&msg, cants_type_telemetry, TM_LED_STATUS, 0, NULL);
+	ground_send(&msg, portMAX_DELAY);
+	check("TM LED status", ground_reply(&msg, cants_type_telemetry) &&
+			(cants_msg_cmd(&msg) & TCTM_RA_MASK) == TCTM_RA_ACK &&
+			msg.length == 1 && msg.data[0] == leds);
+}
+
+/**
+ * @brief Open Set Block session or continue it with next window
+ * @param [in] address start address, NULL to continue session with next window
+ * @param [in] max_seq maximum sequence number in the window
+ * @retval 1 if request was acked, 0 otherwise
+ */
+static uint8_t ground_sb_request(const uint8_t *address, uint8_t max_seq)
+{
+	struct cants_msg msg;
+
+	if (address)
+		ground_msg(&msg, cants_type_set_block, (BLOCK_RA_REQUEST << BLOCK_RA_SHIFT) | max_seq,
+				1, address);
+	else
+		ground_msg(&msg, cants_type_set_block, (BLOCK_RA_REQUEST << BLOCK_RA_SHIFT) |
+				BLOCK_REQUEST_CONTINUE | max_seq, 0, NULL);
+	ground_send(&msg, portMAX_DELAY);
+
+	return ground_reply(&msg, cants_type_set_block) &&
+		cants_msg_cmd(&msg) >> BLOCK_RA_SHIFT == BLOCK_RA_ACK;
+}
+
+/**
+ * @brief Send Set Block window data and check status report
+ * @param [in] data data to write
+ * @param [in] length data length
+ * @retval 1 if window was reported as complete, 0 otherwise
+ */
+static uint8_t ground_sb_transfer(const uint8_t *data, uint16_t length)
+{
+	const uint8_t max_seq = (length - 1) / 8;
+	struct cants_msg msg;
+	uint8_t seq, mask[8] = { 0 };
+
+	for (seq = 0; seq <= max_seq; seq++) {
+		uint8_t len = seq == max_seq ? length - seq * 8 : 8;
+
+		ground_msg(&msg, cants_type_set_block, (BLOCK_RA_SB_TRANSFER << BLOCK_RA_SHIFT) | seq,
+				len, &data[seq * 8]);
+		ground_send(&msg, portMAX_DELAY);
+		mask[seq / 8] |= 1U << (seq % 8);
+	}
+
+	ground_msg(&msg, cants_type_set_block, BLOCK_RA_SB_STATUS << BLOCK_RA_SHIFT, 0, NULL);
+	ground_send(&msg, portMAX_DELAY);
+
+	return ground_reply(&msg, cants_type_set_block) &&
+		cants_msg_cmd(&msg) >> BLOCK_RA_SHIFT == BLOCK_RA_SB_REPORT &&
+		(cants_msg_cmd(&msg) & (1U << 6)) && msg.length == max_seq / 8 + 1 &&
+		!memcmp(msg.data, mask, msg.length);
+}
+
+/**
+ * @brief Open Get Block session or continue it with next window
+ * @param [in] address start address, NULL to continue session with next window
+ * @param [in] max_seq maximum sequence number in the window
+ * @retval 1 if request was acked, 0 otherwise
+ */
+static uint8_t ground_gb_request(const uint8_t *address, uint8_t max_seq)
+{
+	struct cants_msg msg;
+
+	if (address)
+		ground_msg(&msg, cants_type_get_block, (BLOCK_RA_REQUEST << BLOCK_RA_SHIFT) | max_seq,
+				1, address);
+	else
+		ground_msg(&msg, cants_type_get_block, (BLOCK_RA_REQUEST << BLOCK_RA_SHIFT) |
+				BLOCK_REQUEST_CONTINUE | max_seq, 0, NULL);
+	ground_send(&msg, portMAX_DELAY);
+
+	return ground_reply(&msg, cants_type_get_block) &&
+		cants_msg_cmd(&msg) >> BLOCK_RA_SHIFT == BLOCK_RA_ACK;
+}
+
+/**
+ * @brief Start Get Block transmission of all frames in window
+ * @param [in] frames number of frames in the window, 8 at most
+ * @retval None
+ */
+static void ground_gb_start(uint8_t frames)
+{
+	uint8_t mask = (1U << frames) - 1;
+	struct cants_msg msg;
+
+	ground_msg(&msg, cants_type_get_block, BLOCK_RA_GB_START << BLOCK_RA_SHIFT, 1, &mask);
+	ground_send(&msg, portMAX_DELAY);
+}
+
+/**
+ * @brief Receive Get Block window
+ * @param [out] data received data, multiple of 8 bytes
+ * @param [in] frames number of frames in the window
+ * @retval 1 if all frames were received in order, 0 otherwise
+ */
+static uint8_t ground_gb_receive(uint8_t *data, uint8_t frames)
+{
+	struct cants_msg msg;
+	uint8_t seq;
+
+	for (seq = 0; seq < frames; seq++) {
+		if (!ground_reply(&msg, cants_type_get_block) ||
+			cants_msg_cmd(&msg) != ((BLOCK_RA_GB_TRANSFER << BLOCK_RA_SHIFT) | seq) || msg.length != 8)
+			return 0;
+		memcpy(&data[seq * 8], msg.data, 8);
+	}
+
+	return 1;
+}
+
+/**
+ * @brief Start Get Block transmission of all frames in window and receive them
+ * @param [out] data received data, multiple of 8 bytes
+ * @param [in] frames number of frames in the window, 8 at most
+ * @retval 1 if all frames were received in order, 0 otherwise
+ */
+static uint8_t ground_gb_transfer(uint8_t *data, uint8_t frames)
+{
+	ground_gb_start(frames);
+
+	return ground_gb_receive(data, frames);
+}
+
+/**
+ * @brief Abort block transfer session
+ * @param [in] type cants_type_set_block or cants_type_get_block
+ * @retval 1 if abort was acked, 0 otherwise
+ */
+static uint8_t ground_block_abort(uint8_t type)
+{
+	struct cants_msg msg;
+
+	ground_msg(&msg, type, BLOCK_RA_ABORT << BLOCK_RA_SHIFT, 0, NULL);
+	ground_send(&msg, portMAX_DELAY);
+
+	return ground_reply(&msg, type) && cants_msg_cmd(&msg) >> BLOCK_RA_SHIFT == BLOCK_RA_ACK;
+}
+
+/**
+ * @brief Send Set Block status request, which must be nacked, as there is no session
+ * @retval 1 if request was nacked, 0 otherwise
+ */
+static uint8_t ground_sb_status_nacked(void)
+{
+	struct cants_msg msg;
+
+	ground_msg(&msg, cants_type_set_block, BLOCK_RA_SB_STATUS << BLOCK_RA_SHIFT, 0, NULL);
+	ground_send(&msg, portMAX_DELAY);
+
+	return ground_reply(&msg, cants_type_set_block) && cants_msg_cmd(&msg) >> BLOCK_RA_SHIFT == BLOCK_RA_NACK;
+}
+
+/**
+ * @brief Exercise Set Block and Get Block transfers
+ * @retval None
+ */
+static void ground_block(void)
+{
+	uint8_t pattern[20], next[16], readback[24], address = 0x10, i, ok;
+	const uint8_t max_seq = (sizeof(pattern) - 1) / 8;
+	unsigned reads;
+
+	for (i = 0; i < sizeof(pattern); i++)
+		pattern[i] = i * 7 + 1;
+	for (i = 0; i < sizeof(next); i++)
+		next[i] = i * 5 + 3;
+
+	/* Set Block, second window continues right after first one */
+	check("SB request acked", ground_sb_request(&address, max_seq));
+	check("SB report complete", ground_sb_transfer(pattern, sizeof(pattern)));
+	ok = ground_sb_request(NULL, (sizeof(next) - 1) / 8) && ground_sb_transfer(next, sizeof(next));
+	check("SB continue window", ok);
+
+	/* Get Block, second window starts after first 24 bytes */
+	check("GB request acked", ground_gb_request(&address, max_seq));
+	ok = ground_gb_transfer(readback, max_seq + 1);
+	check("GB data read back", ok && !memcmp(pattern, readback, sizeof(pattern)));
+	reads = gb_reads;
+	ok = ground_gb_request(NULL, 1) && ground_gb_transfer(readback, 2);
+	check("GB continue window", ok && !memcmp(&next[4], readback, sizeof(next) - 4));
+
+	/* window read ahead isn't read again, only read-ahead of the following one starts */
+	check("GB continue window read once", gb_reads == reads + 1);
+
+	/* read finishes later than session would time out, start waits for it */
+	ok = ground_block_abort(cants_type_get_block);
+	gb_read_delay = pdMS_TO_TICKS(GB_TIMEOUT + 2 * GB_READING_INTERVAL);
+	ok = ok && ground_gb_request(&address, max_seq);
+	ground_gb_start(max_seq + 1);
+	vTaskDelay(pdMS_TO_TICKS(GB_TIMEOUT + 4 * GB_READING_INTERVAL));
+	ok = ok && !gb_read_delay && ground_gb_receive(readback, max_seq + 1);
+	check("GB window read slowly", ok && !memcmp(pattern, readback, sizeof(pattern)));
+
+	/* finished sessions wait for continue request, until they are aborted */
+	ok = ground_block_abort(cants_type_set_block) && ground_block_abort(cants_type_get_block);
+	check("block sessions aborted", ok && block_arena_free_buffers() == BLOCK_ARENA_BUFFERS);
+}
+
+/**
+ * @brief Send TC while Get Block burst is queued for transmission, its ack must overtake the burst
+ * @retval None
+ */
+static void ground_tx_priority(void)
+{
+	const uint8_t leds = 0x5a, mask[4] = { 0xff, 0xff, 0xff, 0xff };
+	uint8_t address = 0, ok, acked = 0, behind = 0;
+	struct cants_msg msg;
+
+	/* window of 32 frames takes several bursts */
+	ok = ground_gb_request(&address, 8 * sizeof(mask) - 1);
+	ground_msg(&msg, cants_type_get_block, BLOCK_RA_GB_START << BLOCK_RA_SHIFT, sizeof(mask), mask);
+	ground_send(&msg, portMAX_DELAY);
+
+	/* burst is queued, when its first frame arrives */
+	ok = ok && ground_reply(&msg, cants_type_get_block);
+	ground_msg(&msg, cants_type_telecommand, TC_SET_LED, 1, &leds);
+	ground_send(&msg, portMAX_DELAY);
+	while (!acked && ground_recv(&msg, REPLY_TIMEOUT)) {
+		if (cants_msg_src(&msg) != CANTS_NODE_ID || cants_msg_dst(&msg) != ground_src)
+			continue;
+		if (cants_msg_type(&msg) == cants_type_get_block)
+			behind++;
+		if (cants_msg_type(&msg) == cants_type_telecommand)
+			acked = (cants_msg_cmd(&msg) & TCTM_RA_MASK) == TCTM_RA_ACK;
+	}
+
+	/* rest of the window follows */
+	while (ground_reply(&msg, cants_type_get_block))
+		;
+	ok = ground_block_abort(cants_type_get_block) && ok;
+
+	/* frames sent while TC is received and its ack is queued may still go first, not rest of the burst */
+	check("TC ack overtakes GB burst", ok && acked && behind < GB_BURST_SIZE / 2);
+}
+
+/**
+ * @brief Leave Set Block and Get Block sessions without traffic, until they time out
+ * @retval None
+ */
+static void ground_session_timeout(void)
+{
+	uint8_t address = 0x10, ok;
+	TickType_t start;
+
+	/* SB session waits for data, GB one for start */
+	ok = ground_sb_request(&address, 1) && ground_gb_request(&address, 1) &&
+			block_arena_free_buffers() < BLOCK_ARENA_BUFFERS;
+
+	/* only keep-alive keeps node on this bus meanwhile */
+	start = xTaskGetTickCount();
+	while (xTaskGetTickCount() - start < pdMS_TO_TICKS((SB_TIMEOUT > GB_TIMEOUT ? SB_TIMEOUT : GB_TIMEOUT) + 100)) {
+		ground_master_keepalive();
+		vTaskDelay(pdMS_TO_TICKS(REDUNDANCY_PERIOD / 2));
+	}
+
+	/* sessions are gone, so continue request and status are nacked */
+	ok = ok && !ground_gb_request(NULL, 1) && ground_sb_status_nacked();
+	check("block sessions time out", ok && block_arena_free_buffers() == BLOCK_ARENA_BUFFERS);
+}
+
+/**
+ * @brief Exhaust block transfer arena with sessions of several sources
+ * @retval None
+ */
+static void ground_arena(void)
+{
+	uint8_t address = 0x10, sb = 0, gb = 0, ok = 1, i;
+
+	/* sessions of other sources lease buffers, GB session second one for read-ahead */
+	while (ok && block_arena_free_buffers() && sb < MAX_SB_SESSIONS) {
+		ground_src = ARENA_SOURCE + sb++;
+		ok = ground_sb_request(&address, 0);
+	}
+	/* one GB session slot is left for request, which finds arena exhausted */
+	while (ok && block_arena_free_buffers() && gb + 1 < MAX_GB_SESSIONS) {
+		ground_src = ARENA_SOURCE + sb + gb++;
+		ok = ground_gb_request(&address, 0);
+	}
+	check("arena held by block sessions", ok && !block_arena_free_buffers());
+
+	/* free session slot doesn't help without buffer */
+	ground_src = ARENA_SOURCE + sb + gb;
+	check("GB request nacked on exhausted arena", !ground_gb_request(&address, 0));
+	ground_src = ARENA_SOURCE;
+	ok = ground_block_abort(sb ? cants_type_set_block : cants_type_get_block);
+	ground_src = ARENA_SOURCE + sb + gb;
+	check("GB request acked with buffer free", ok && ground_gb_request(&address, 0));
+
+	ok = ground_block_abort(cants_type_get_block);
+	for (i = 1; i < sb + gb; i++) {
+		ground_src = ARENA_SOURCE + i;
+		ok = ground_block_abort(i < sb ? cants_type_set_block : cants_type_get_block) && ok;
+	}
+	ground_src = GROUND_ID;
+	check("arena free after abort", ok && block_arena_free_buffers() == BLOCK_ARENA_BUFFERS);
+}
+
+/**
+ * @brief Get time of simulated spacecraft clock, which drifts against host clock
+ * @retval spacecraft time in microseconds
+ */
+static uint64_t ground_sc_time(void)
+{
+	uint64_t elapsed = (ullPortGetTimeNs() - start_ns) / 1000;
+
+	return SYNC_EPOCH * 1000000ULL + elapsed + elapsed * SYNC_DRIFT_PPM / 1000000;
+}
+
+/**
+ * @brief Exercise time synchronisation and spacecraft time telemetry
+ * @retval None
+ */
+static void ground_time_sync(void)
+{
+	struct cants_msg msg;
+	int64_t error;
+	int32_t ppm;
+	uint8_t i, ok;
+
+	ground_msg(&msg, cants_type_telemetry, TM_SPACECRAFT_TIME, 0, NULL);
+	ground_send(&msg, portMAX_DELAY);
+	check("TM time nacked before sync", ground_reply(&msg, cants_type_telemetry) &&
+			(cants_msg_cmd(&msg) & TCTM_RA_MASK) == TCTM_RA_NACK);
+
+	for (i = 0; i < SYNC_COUNT; i++) {
+		cants_msg_set_id(&msg, CANTS_TIME_ID, cants_type_time_sync, GROUND_ID, 0);
+		msg.length = sctime_encode(ground_sc_time(), msg.data);
+		ground_send(&msg, portMAX_DELAY);
+
+		/* keep node on this bus */
+		ground_master_keepalive();
+		vTaskDelay(pdMS_TO_TICKS(SYNC_INTERVAL));
+	}
+
+	/* node extrapolates SYNC_INTERVAL since last sync with drift estimate */
+	ground_msg(&msg, cants_type_telemetry, TM_SPACECRAFT_TIME, 0, NULL);
+	ground_send(&msg, portMAX_DELAY);
+	ok = ground_reply(&msg, cants_type_telemetry) &&
+			(cants_msg_cmd(&msg) & TCTM_RA_MASK) == TCTM_RA_ACK && msg.length == 7;
+	error = 0;
+	if (ok) {
+		uint64_t sc = ((uint64_t)msg.data[0] << 24 | msg.data[1] << 16 | msg.data[2] << 8 | msg.data[3]) * 1000000ULL +
+			(((uint64_t)(msg.data[4] << 16 | msg.data[5] << 8 | msg.data[6]) * 1000000ULL) >> 24);
+
+		error = (int64_t)(ground_sc_time() - sc);
+	}
+	check("TM spacecraft time", ok && error > -1000 && error < 1000);
+
+	/* drift is in parts per 2^24 */
+	ppm = (int64_t)sctime_drift() * 1000000 / (1L << SCTIME_DRIFT_FRAC);
+	check("local clock drift estimated", ppm > SYNC_DRIFT_PPM * 3 / 4 && ppm < SYNC_DRIFT_PPM * 5 / 4);
+	printf("%-40s %ld us, %ld ppm\n", "  time error, drift", (long)error, (long)ppm);
+}
+
+/**
+ * @brief Exercise load shedding of received frames, when message pool runs low
+ * @retval None
+ */
+static void ground_shedding(void)
+{
+	static struct cants_msg *held[CANTS_MSG_POOL_SIZE];
+	const uint8_t leds = 0x5a, data[8] = { 0 };
+	struct cants_stats before, after;
+	struct cants_msg msg;
+	uint8_t count = 0, ok;
+
+	/* leave less than needed by SB data frames, but enough for commands */
+	cants_get_stats(&before);
+	while (cants_msg_pool_free() > CANTS_MSG_POOL_TX_RESERVE + CANTS_SHED_BULK / 2)
+		held[count++] = cants_msg_alloc();
+
+	ground_msg(&msg, cants_type_set_block, BLOCK_RA_SB_TRANSFER << BLOCK_RA_SHIFT, sizeof(data), data);
+	ground_send(&msg, portMAX_DELAY);
+	ground_msg(&msg, cants_type_telecommand, TC_SET_LED, 1, &leds);
+	ground_send(&msg, portMAX_DELAY);
+	ok = ground_reply(&msg, cants_type_telecommand) && (cants_msg_cmd(&msg) & TCTM_RA_MASK) == TCTM_RA_ACK;
+
+	while (count)
+		cants_msg_free(held[--count]);
+	cants_get_stats(&after);
+
+	check("SB data shed before TC on low pool", ok &&
+			after.rx_shed[cants_rx_bulk] == before.rx_shed[cants_rx_bulk] + 1 &&
+			after.rx_shed[cants_rx_control] == before.rx_shed[cants_rx_control]);
+}
+
+/**
+ * @brief Stop node tasks, so frames sent next are only taken by CAN ISR. Tick
+ * count doesn't advance meanwhile, so RX timestamps aren't traced.
+ * @retval number of frames carried by primary bus so far
+ */
+static uint32_t ground_hold(void)
+{
+	struct vcan_bus_stats bus;
+
+	sim_trace_hook = NULL;
+	vcan_get_stats(0, &bus);
+	vTaskSuspendAll();
+
+	return bus.frames;
+}
+
+/**
+ * @brief Let node tasks run again, once primary bus has carried all frames sent since ground_hold()
+ * @param [in] frames expected number of frames carried by primary bus
+ * @retval None
+ */
+static void ground_release(uint32_t frames)
+{
+	struct vcan_bus_stats bus;
+
+	do {
+		/* emulated interrupts are serviced, when they are enabled again */
+		taskENTER_CRITICAL();
+		vcan_get_stats(0, &bus);
+		taskEXIT_CRITICAL();
+	} while (bus.frames != frames);
+	xTaskResumeAll();
+	sim_trace_hook = rx_time_trace;
+}
+
+/**
+ * @brief Fill part of dispatcher ring left to time sync and unsolicited TM,
+ * while dispatcher doesn't run, until ring indices wrap
+ * @retval None
+ */
+static void ground_ring(void)
+{
+	const uint8_t leds = 0x5a, share = DISPATCHER_QUEUE_LEN - DISPATCHER_TC_QUOTA -
+			DISPATCHER_TM_QUOTA - DISPATCHER_SB_QUOTA - DISPATCHER_GB_QUOTA;
+	struct cants_stats before, after;
+	struct cants_msg msg;
+	uint8_t i, rounds, ok;
+	uint32_t frames;
+
+	/* unsolicited TM sent to node goes through dispatcher, ring indices wrap after 256 frames */
+	cants_get_stats(&before);
+	for (rounds = 0; rounds <= 256 / share; rounds++) {
+		frames = ground_hold() + share + OVERLOAD_EXTRA;
+		ground_msg(&msg, cants_type_unsolicited_tm, 0, 0, NULL);
+		for (i = 0; i < share + OVERLOAD_EXTRA; i++)
+			ground_send(&msg, 0);
+		ground_release(frames);
+	}
+	cants_get_stats(&after);
+
+	/* share must be taken and released exactly, sum of quotas leaves no room for overflow */
+	ground_msg(&msg, cants_type_telecommand, TC_SET_LED, 1, &leds);
+	ground_send(&msg, portMAX_DELAY);
+	ok = ground_reply(&msg, cants_type_telecommand) && (cants_msg_cmd(&msg) & TCTM_RA_MASK) == TCTM_RA_ACK;
+	check("dispatcher ring share full drops frames", ok && after.rx_overflow == before.rx_overflow &&
+			after.rx_dropped[cants_type_unsolicited_tm] ==
+			before.rx_dropped[cants_type_unsolicited_tm] + rounds * OVERLOAD_EXTRA);
+}
+
+/**
+ * @brief Exercise dispatcher admission control with flood of TM requests, which node tasks can't serve in time
+ * @retval None
+ */
+static void ground_overload(void)
+{
+	const uint8_t leds = 0x5a;
+	struct cants_stats before, after;
+	struct cants_msg msg;
+	uint8_t i, tm_ack = 0, tm_nack = 0, tc_ack = 0, flood, admitted, over, nacked;
+	uint32_t frames;
+
+	/* with ISR routing TM queue is filled directly, dispatcher ring takes its quota on top of that */
+	flood = TM_QUEUE_LEN + DISPATCHER_TM_QUOTA + OVERLOAD_EXTRA;
+	admitted = DISPATCHER_TM_QUOTA + (CANTS_ISR_ROUTING ? TM_QUEUE_LEN : 0);
+	over = flood - admitted;
+	/* admitted requests, which don't fit in TM queue, and those over quota, which fit in nack ring */
+	nacked = admitted - TM_QUEUE_LEN + (over < DISPATCHER_NACK_LEN ? over : DISPATCHER_NACK_LEN);
+
+	/* node tasks don't run, until ISR has taken the whole flood and TC behind it */
+	cants_get_stats(&before);
+	frames = ground_hold() + flood + 1;
+	ground_msg(&msg, cants_type_telemetry, TM_LED_STATUS, 0, NULL);
+	for (i = 0; i < flood; i++)
+		ground_send(&msg, 0);
+	ground_msg(&msg, cants_type_telecommand, TC_SET_LED, 1, &leds);
+	ground_send(&msg, 0);
+	ground_release(frames);
+
+	while (ground_recv(&msg, REPLY_TIMEOUT)) {
+		if (cants_msg_src(&msg) != CANTS_NODE_ID || cants_msg_dst(&msg) != GROUND_ID)
+			continue;
+		if (cants_msg_type(&msg) == cants_type_telemetry)
+			(cants_msg_cmd(&msg) & TCTM_RA_MASK) == TCTM_RA_ACK ? tm_ack++ : tm_nack++;
+		if (cants_msg_type(&msg) == cants_type_telecommand)
+			tc_ack += (cants_msg_cmd(&msg) & TCTM_RA_MASK) == TCTM_RA_ACK;
+	}
+	cants_get_stats(&after);
+
+	/* TM queue is served, dispatcher nacks requests, which don't fit in it */
+	check("TM flood doesn't hold up TC", tc_ack == 1 && tm_ack == TM_QUEUE_LEN && tm_nack == nacked &&
+			after.rx_nack[cants_type_telemetry] == before.rx_nack[cants_type_telemetry] + nacked &&
+			after.rx_dropped[cants_type_telemetry] == before.rx_dropped[cants_type_telemetry] + flood - TM_QUEUE_LEN - nacked);
+}
+
+/**
+ * @brief Exercise keep-alive transmission and reception
+ * @retval None
+ */
+static void ground_keepalive(void)
+{
+	struct cants_msg msg;
+	uint8_t ok = 0;
+
+	/* redundancy master keep-alive must be accepted silently */
+	cants_msg_set_id(&msg, CANTS_KEEPALIVE_ID, cants_type_unsolicited_tm, REDUNDANCY_MASTER_ID, 0);
+	msg.length = 0;
+	ground_send(&msg, portMAX_DELAY);
+
+	/* node sends keep-alive every 2 s */
+	while (!ok && ground_recv(&msg, pdMS_TO_TICKS(2500)))
+		ok = cants_msg_type(&msg) == cants_type_unsolicited_tm && cants_msg_src(&msg) == CANTS_NODE_ID &&
+			cants_msg_dst(&msg) == CANTS_KEEPALIVE_ID;
+	check("node keep-alive received", ok);
+}
+
+/**
+ * @brief Ground station task, runs all scenarios and stops the simulation
+ * @param [in] arg ignored
+ * @retval None
+ */
+static void ground_task(void *arg)
+{
+	(void)arg;
+
+	/* tick count started at scheduler start */
+	taskENTER_CRITICAL();
+	start_ns = ullPortGetNextTickNs() - (xTaskGetTickCount() + 1ULL) * (1000000000ULL / configTICK_RATE_HZ);
+	taskEXIT_CRITICAL();
+	sim_trace_hook = rx_time_trace;
+
+	ground_tctm();
+	ground_block();
+	ground_arena();
+	ground_tx_priority();
+	ground_session_timeout();
+	ground_shedding();
+	ground_overload();
+	ground_ring();
+	ground_keepalive();
+	ground_time_sync();
+
+	/* frames are timestamped in CAN ISR, so host time may only be a bit later */
+	sim_trace_hook = NULL;
+	check("RX timestamps follow tick timer", !rx_time_reversed && rx_time_error < 20);
+
+	printf("%u check(s) failed\n", failures);
+	vTaskEndScheduler();
+}
+
+int main(void)
+{
+	/* connect node and ground station to virtual busses */
+	vcan_init(true);
+	vcan_attach(CAN0, 0, can0_handler);
+	vcan_attach(CAN1, 1, can1_handler);
+	ground_init();
+
+	/* set LED pins to output direction and turn them off */
+	gpio_set_port(GPIO5, 0);
+	gpio_set_direction(GPIO5, GPIO_PIN_ALL, GPIO_DIR_OUT);
+
+	/* Initialize CAN-TS stack and CAN controller */
+	candrv_init();
+
+	reader_task = xTaskCreateStatic(reader, "READER", ARRAY_SIZE(reader_task_stack),
+			NULL, GROUND_PRIORITY, reader_task_stack, &reader_task_buffer);
+	xTaskCreateStatic(ground_task, "GROUND", ARRAY_SIZE(ground_task_stack),
+			NULL, GROUND_PRIORITY, ground_task_stack, &ground_task_buffer);
+
+	/* run tasks until ground station finishes */
+	vTaskStartScheduler();
+
+	return failures != 0;
+}
+
+/**
+ * @}
+ */
@@ -0,0 +1,24 @@
+/**
+ * @file interrupt.h
+ *
+ */
+
+/**
+ * @addtogroup Sim
+ * @{
+ */
+
+#ifndef SIM_INTERRUPT_H_
+#define SIM_INTERRUPT_H_
+
+/*
+ * On host, interrupt handlers are plain functions called by the emulated
+ * peripheral, see vcan.c.
+ */
+#define ISR(name, ...) void name(void); void name(void)
+
+#endif
+
+/**
+ * @}
+ */
@@ -0,0 +1,35 @@
+/**
+ * @file sim_trace.h
+ *
+ */
+
+/**
+ * @addtogroup Sim
+ * @{
+ */
+
+#ifndef SIM_TRACE_H_
+#define SIM_TRACE_H_
+
+#include <stdint.h>
+
+struct cants_msg;
+
+/**
+ * @brief Simulator tracing hook, NULL if tracing is disabled
+ * @param [in] point one of ::cants_trace_point
+ * @param [in] msg traced message
+ */
+extern void (*sim_trace_hook)(uint8_t point, struct cants_msg *msg);
+
+/* CAN-TS stack tracing hook, see cants.h */
+#define cants_trace(point, msg) do { \
+		if (sim_trace_hook) \
+			sim_trace_hook((point), (msg)); \
+	} while (0)
+
+#endif
+
+/**
+ * @}
+ */
@@ -0,0 +1,52 @@
+/**
+ * @file timer.c
+ *
+ */
+
+/**
+ * @addtogroup Sim
+ * @{
+ */
+
+#include "FreeRTOS.h"
+#include "soc.h"
+#include "timer.h"
+
+/*
+ * Only TIM0 is emulated, as FreeRTOS tick timer running at SOC_CLOCK. Its
+ * counter is derived from host time remaining to the next tick of Posix port.
+ */
+
+/** tick period in ns */
+#define VTIMER_TICK_NS (1000000000ULL / configTICK_RATE_HZ)
+
+/**
+ * @brief Get host time elapsed since last processed tick
+ * @retval time in ns, VTIMER_TICK_NS or more if tick is pending
+ */
+static uint64_t vtimer_elapsed(void)
+{
+	return ullPortGetTimeNs() + VTIMER_TICK_NS - ullPortGetNextTickNs();
+}
+
+bool timer_is_overflow(struct timer *base)
+{
+	return base == TIM0 && vtimer_elapsed() >= VTIMER_TICK_NS;
+}
+
+uint16_t timer_get_count(struct timer *base)
+{
+	uint64_t elapsed;
+
+	if (base != TIM0)
+		return 0;
+
+	/* counter restarts at each tick, even if tick interrupt is pending */
+	elapsed = vtimer_elapsed() % VTIMER_TICK_NS;
+
+	return elapsed * (SOC_CLOCK / 1000000UL) / 1000UL;
+}
+
+/**
+ * @}
+ */
@@ -0,0 +1,17 @@
+/**
+ * @file trace.c
+ *
+ */
+
+/**
+ * @addtogroup Sim
+ * @{
+ */
+
+#include "sim_trace.h"
+
+void (*sim_trace_hook)(uint8_t point, struct cants_msg *msg);
+
+/**
+ * @}
+ */
@@ -0,0 +1,436 @@
+/**
+ * @file vcan.c
+ *
+ */
+
+/**
+ * @defgroup Sim Host simulator
+ * @brief Host side emulation of PicoSkyFT peripherals used by CAN-TS stack
+ * @{
+ */
+
+#include <string.h>
+
+#include "FreeRTOS.h"
+#include "vcan.h"
+
+/**
+ * @struct vcan_frame
+ * @brief CAN frame on virtual bus
+ */
+struct vcan_frame {
+	uint32_t id; /**< CAN identifier */
+	uint8_t len; /**< data length */
+	uint8_t data[8]; /**< frame data */
+	bool ext; /**< extended identifier flag */
+	bool rtr; /**< remote transmission request flag */
+};
+/**
+ *@}
+ */
+
+/**
+ * @struct vcan_ctrl
+ * @brief State of virtual SJA1000 compatible controller
+ */
+struct vcan_ctrl {
+	struct can *base; /**< handle used by CAN driver API */
+	vcan_isr_t isr; /**< interrupt handler */
+	uint8_t bus; /**< bus to which controller is attached */
+	uint8_t mod; /**< mode register */
+	uint8_t ier; /**< interrupt enable register */
+	uint8_t ir; /**< interrupt register */
+	uint8_t sr; /**< status register, without RBS and TBS */
+	uint32_t rate; /**< baud rate */
+	uint32_t filter_id; /**< acceptance filter ID */
+	uint32_t filter_mask; /**< acceptance filter mask, 1 bits have to match */
+	bool filter_ext; /**< acceptance filter applies to extended frames */
+	struct vcan_frame rx[VCAN_RX_FIFO_LEN]; /**< RX FIFO */
+	uint8_t rx_head; /**< index of oldest frame in RX FIFO */
+	uint8_t rx_count; /**< number of frames in RX FIFO */
+	struct vcan_frame tx; /**< TX buffer */
+	bool tx_pending; /**< TX buffer holds frame waiting for transmission */
+};
+/**
+ *@}
+ */
+
+/**
+ * @struct vcan_bus
+ * @brief State of virtual CAN bus
+ */
+struct vcan_bus {
+	struct vcan_ctrl *sender; /**< controller whose frame is on the bus */
+	uint64_t busy_until; /**< time when current frame transmission finishes */
+	struct vcan_bus_stats stats; /**< bus statistics */
+};
+/**
+ *@}
+ */
+
+static struct vcan_ctrl ctrls[VCAN_MAX_CTRL];
+static uint8_t ctrl_count;
+static struct vcan_bus busses[VCAN_BUS_COUNT];
+static bool use_line_rate;
+
+/**
+ * @brief Find controller state by its handle
+ * @param [in] base controller handle
+ * @retval controller state
+ */
+static struct vcan_ctrl *vcan_ctrl(struct can *base)
+{
+	uint8_t i;
+
+	for (i = 0; i < ctrl_count; i++)
+		if (ctrls[i].base == base)
+			return &ctrls[i];
+
+	configASSERT(0);
+	return NULL;
+}
+
+/**
+ * @brief Latch interrupt flag, if it is enabled
+ * @param [in] ctrl controller state
+ * @param [in] irq interrupt flag
+ * @retval None
+ */
+static void vcan_raise(struct vcan_ctrl *ctrl, uint8_t irq)
+{
+	ctrl->ir |= ctrl->ier & irq;
+}
+
+/**
+ * @brief Calculate frame duration on the bus
+ * @param [in] ctrl transmitting controller
+ * @param [in] frm frame to transmit
+ * @retval duration in ns
+ */
+static uint64_t vcan_frame_time(struct vcan_ctrl *ctrl, struct vcan_frame *frm)
+{
+	/* frame bits without stuffing, including 3 bit interframe space */
+	uint32_t bits = (frm->ext ? 67 : 47) + (frm->rtr ? 0 : 8U * frm->len);
+
+	if (!use_line_rate || !ctrl->rate)
+		return 0;
+
+	return (uint64_t)bits * 1000000000ULL / ctrl->rate;
+}
+
+/**
+ * @brief Deliver frame to all other controllers on the same bus
+ * @param [in] bus bus state
+ * @retval None
+ */
+static void vcan_deliver(struct vcan_bus *bus)
+{
+	struct vcan_ctrl *sender = bus->sender;
+	struct vcan_frame *frm = &sender->tx;
+	uint8_t i;
+
+	for (i = 0; i < ctrl_count; i++) {
+		struct vcan_ctrl *ctrl = &ctrls[i];
+
+		if (ctrl == sender || ctrl->bus != sender->bus || (ctrl->mod & CAN_MOD_RM))
+			continue;
+
+		/* acceptance filtering */
+		if (ctrl->filter_ext == frm->ext && ((frm->id ^ ctrl->filter_id) & ctrl->filter_mask))
+			continue;
+
+		if (ctrl->rx_count == VCAN_RX_FIFO_LEN) {
+			ctrl->sr |= CAN_SR_DOS;
+			vcan_raise(ctrl, CAN_IRQ_DOI);
+			bus->stats.lost++;
+			continue;
+		}
+
+		ctrl->rx[(ctrl->rx_head + ctrl->rx_count++) % VCAN_RX_FIFO_LEN] = *frm;
+		vcan_raise(ctrl, CAN_IRQ_RI);
+	}
+
+	sender->tx_pending = false;
+	sender->sr |= CAN_SR_TCS;
+	vcan_raise(sender, CAN_IRQ_TI);
+	bus->stats.frames++;
+	bus->sender = NULL;
+}
+
+/**
+ * @brief Advance state of one bus: finish frame on the bus and arbitrate next one
+ * @param [in] bus bus state
+ * @param [in] now current time
+ * @retval None
+ */
+static void vcan_bus_service(struct vcan_bus *bus, uint64_t now)
+{
+	uint8_t i, index = bus - busses;
+	uint64_t start;
+
+	while (1) {
+		struct vcan_ctrl *winner = NULL;
+
+		start = now;
+		if (bus->sender) {
+			if (now < bus->busy_until) {
+				vPortRequestWakeup(bus->busy_until);
+				return;
+			}
+			vcan_deliver(bus);
+			/* frame waiting in arbitration starts right after the previous one */
+			start = bus->busy_until;
+		}
+
+		/* arbitration, lowest ID wins */
+		for (i = 0; i < ctrl_count; i++) {
+			struct vcan_ctrl *ctrl = &ctrls[i];
+
+			if (ctrl->bus == index && ctrl->tx_pending && !(ctrl->mod & CAN_MOD_RM) &&
+				(!winner || ctrl->tx.id < winner->tx.id))
+				winner = ctrl;
+		}
+
+		if (!winner)
+			return;
+
+		bus->sender = winner;
+		bus->busy_until = start + vcan_frame_time(winner, &winner->tx);
+		bus->stats.busy_ns += bus->busy_until - start;
+	}
+}
+
+/**
+ * @brief Emulated interrupt source, advances busses and calls controller ISRs
+ * @retval None
+ */
+static void vcan_service(void)
+{
+	uint64_t now = ullPortGetTimeNs();
+	uint8_t i;
+
+	for (i = 0; i < VCAN_BUS_COUNT; i++)
+		vcan_bus_service(&busses[i], now);
+
+	for (i = 0; i < ctrl_count; i++) {
+		struct vcan_ctrl *ctrl = &ctrls[i];
+
+		if ((ctrl->ir & ctrl->ier) && ctrl->isr)
+			ctrl->isr();
+	}
+}
+
+void vcan_init(bool line_rate)
+{
+	use_line_rate = line_rate;
+	configASSERT(xPortRegisterInterruptHandler(vcan_service) == pdPASS);
+}
+
+void vcan_attach(struct can *base, uint8_t bus, vcan_isr_t isr)
+{
+	struct vcan_ctrl *ctrl;
+
+	configASSERT(ctrl_count < VCAN_MAX_CTRL && bus < VCAN_BUS_COUNT);
+
+	ctrl = &ctrls[ctrl_count++];
+	memset(ctrl, 0, sizeof(*ctrl));
+	ctrl->base = base;
+	ctrl->bus = bus;
+	ctrl->isr = isr;
+	ctrl->mod = CAN_MOD_RM;
+}
+
+void vcan_get_stats(uint8_t bus, struct vcan_bus_stats *stats)
+{
+	configASSERT(bus < VCAN_BUS_COUNT);
+	*stats = busses[bus].stats;
+}
+
+/* CAN driver API, see can.h */
+
+void can_set_baudrate(struct can *base, uint32_t rate, uint16_t sp)
+{
+	(void)sp;
+	vcan_ctrl(base)->rate = rate;
+}
+
+void can_set_rx_filter(struct can *base, uint32_t id, uint32_t mask, bool extended)
+{
+	struct vcan_ctrl *ctrl = vcan_ctrl(base);
+
+	ctrl->filter_id = id;
+	ctrl->filter_mask = mask;
+	ctrl->filter_ext = extended;
+}
+
+void can_set_dual_rx_filter(struct can *base, uint32_t id1, uint32_t mask1, uint32_t id2, uint32_t mask2, bool extended)
+{
+	/* approximate with single filter, which accepts both IDs */
+	(void)id2;
+	can_set_rx_filter(base, id1, mask1 & mask2 & ~(id1 ^ id2), extended);
+}
+
+void can_enable_interrupt(struct can *base, uint8_t irq, bool enabled)
+{
+	struct vcan_ctrl *ctrl = vcan_ctrl(base);
+
+	if (enabled)
+		ctrl->ier |= irq;
+	else
+		ctrl->ier &= ~irq;
+}
+
+void can_send_packet(struct can *base, uint32_t id, uint8_t len, uint8_t *data, bool rtr, bool extended)
+{
+	struct vcan_ctrl *ctrl = vcan_ctrl(base);
+
+	/* writing into busy TX buffer is not allowed */
+	configASSERT(!ctrl->tx_pending);
+
+	if (len > 8)
+		len = 8;
+
+	ctrl->tx.id = id & (extended ? 0x1fffffffUL : 0x7ffUL);
+	ctrl->tx.len = len;
+	ctrl->tx.ext = extended;
+	ctrl->tx.rtr = rtr;
+	if (!rtr)
+		memcpy(ctrl->tx.data, data, len);
+
+	ctrl->sr &= ~CAN_SR_TCS;
+	ctrl->tx_pending = true;
+}
+
+void can_encode_packet(struct can_frame *frame, uint32_t id, uint8_t len, const uint8_t *data, bool rtr, bool extended)
+{
+	/* same register layout as can.c, can_send_frame() decodes it back */
+	if (len > 8)
+		len = 8;
+
+	frame->frm = len | (extended ? CAN_FRM_FF : 0) | (rtr ? CAN_FRM_RTR : 0);
+
+	if (extended) {
+		frame->data[0] = (uint8_t)(id >> 21);
+		frame->data[1] = (uint8_t)(id >> 13);
+		frame->data[2] = (uint8_t)(id >> 5);
+		frame->data[3] = (uint8_t)(id << 3);
+	} else {
+		frame->data[0] = (uint8_t)(id >> 3);
+		frame->data[1] = (uint8_t)(id << 5);
+	}
+
+	if (!rtr)
+		memcpy(&frame->data[extended ? 4 : 2], data, len);
+}
+
+void can_send_frame(struct can *base, const struct can_frame *frame)
+{
+	bool extended = frame->frm & CAN_FRM_FF;
+	uint8_t data[8];
+	uint32_t id;
+
+	/* decode image as controller would read it from registers */
+	if (extended)
+		id = ((uint32_t)frame->data[0] << 21) | ((uint32_t)frame->data[1] << 13) |
+			((uint32_t)frame->data[2] << 5) | (frame->data[3] >> 3);
+	else
+		id = ((uint32_t)frame->data[0] << 3) | (frame->data[1] >> 5);
+
+	memcpy(data, &frame->data[extended ? 4 : 2], 8);
+	can_send_packet(base, id, frame->frm & CAN_FRM_DLC_MSK, data, frame->frm & CAN_FRM_RTR, extended);
+}
+
+void can_recv_packet(struct can *base, uint32_t *id, uint8_t *len, uint8_t *data, bool *rtr, bool *extended)
+{
+	struct vcan_ctrl *ctrl = vcan_ctrl(base);
+	struct vcan_frame *frm;
+
+	configASSERT(ctrl->rx_count);
+
+	frm = &ctrl->rx[ctrl->rx_head];
+	*id = frm->id;
+	*len = frm->len;
+	*rtr = frm->rtr;
+	*extended = frm->ext;
+	if (!frm->rtr)
+		memcpy(data, frm->data, frm->len);
+
+	/* release receive buffer */
+	ctrl->rx_head = (ctrl->rx_head + 1) % VCAN_RX_FIFO_LEN;
+	ctrl->rx_count--;
+}
+
+uint8_t can_get_status(struct can *base)
+{
+	struct vcan_ctrl *ctrl = vcan_ctrl(base);
+	uint8_t sr = ctrl->sr;
+
+	if (ctrl->rx_count)
+		sr |= CAN_SR_RBS;
+	if (!ctrl->tx_pending)
+		sr |= CAN_SR_TBS;
+
+	return sr;
+}
+
+uint8_t can_get_int_status(struct can *base)
+{
+	struct vcan_ctrl *ctrl = vcan_ctrl(base);
+	uint8_t ir = ctrl->ir;
+
+	/* reading clears all flags, except RI, which is set while RX FIFO is not empty */
+	ctrl->ir = 0;
+	if (ctrl->rx_count)
+		ir |= ctrl->ier & CAN_IRQ_RI;
+
+	return ir;
+}
+
+void can_reset_mode(struct can *base, bool enabled)
+{
+	struct vcan_ctrl *ctrl = vcan_ctrl(base);
+
+	if (enabled) {
+		/* reset mode aborts transmission and clears receive FIFO */
+		ctrl->mod |= CAN_MOD_RM;
+		if (busses[ctrl->bus].sender != ctrl)
+			ctrl->tx_pending = false;
+		ctrl->rx_count = 0;
+		ctrl->ir = 0;
+		ctrl->sr &= ~CAN_SR_DOS;
+	} else {
+		ctrl->mod &= ~CAN_MOD_RM;
+	}
+}
+
+uint8_t can_get_rx_error_count(struct can *base)
+{
+	(void)base;
+	return 0;
+}
+
+uint8_t can_get_tx_error_count(struct can *base)
+{
+	(void)base;
+	return 0;
+}
+
+void can_command(struct can *base, uint8_t cmd)
+{
+	struct vcan_ctrl *ctrl = vcan_ctrl(base);
+
+	if (cmd & CAN_CMR_CDO)
+		ctrl->sr &= ~CAN_SR_DOS;
+
+	if ((cmd & CAN_CMR_AT) && busses[ctrl->bus].sender != ctrl)
+		ctrl->tx_pending = false;
+
+	if ((cmd & CAN_CMR_RRB) && ctrl->rx_count) {
+		ctrl->rx_head = (ctrl->rx_head + 1) % VCAN_RX_FIFO_LEN;
+		ctrl->rx_count--;
+	}
+}
+
+/**
+ * @}
+ */
@@ -0,0 +1,75 @@
+/**
+ * @file vcan.h
+ *
+ */
+
+/**
+ * @addtogroup Sim
+ * @{
+ */
+
+#ifndef VCAN_H_
+#define VCAN_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "can.h"
+
+/** number of virtual CAN busses */
+#define VCAN_BUS_COUNT 2
+
+/** maximum number of controllers attached to all busses */
+#define VCAN_MAX_CTRL 8
+
+/** number of frames which fit into controller RX FIFO (64 byte FIFO of SJA1000) */
+#define VCAN_RX_FIFO_LEN 4
+
+/**
+ * @brief Virtual CAN controller interrupt handler
+ */
+typedef void (*vcan_isr_t)(void);
+
+/**
+ * @struct vcan_bus_stats
+ * @brief Statistics of one virtual CAN bus
+ */
+struct vcan_bus_stats {
+	uint32_t frames; /**< number of frames transmitted on the bus */
+	uint32_t lost; /**< number of frames dropped by full RX FIFOs */
+	uint64_t busy_ns; /**< time spent transmitting frames */
+};
+/**
+ *@}
+ */
+
+/**
+ * @brief Initialize virtual CAN bus and register it as emulated interrupt source
+ * @param [in] line_rate true if frames take time on the bus according to
+ * configured baud rate, false if they are delivered immediately
+ * @retval None
+ */
+void vcan_init(bool line_rate);
+
+/**
+ * @brief Attach virtual controller to a bus
+ * @param [in] base Controller handle, as used with CAN driver functions. It is never dereferenced.
+ * @param [in] bus Bus index, less than ::VCAN_BUS_COUNT
+ * @param [in] isr Interrupt handler of the controller
+ * @retval None
+ */
+void vcan_attach(struct can *base, uint8_t bus, vcan_isr_t isr);
+
+/**
+ * @brief Get bus statistics
+ * @param [in] bus Bus index
+ * @param [out] stats Statistics
+ * @retval None
+ */
+void vcan_get_stats(uint8_t bus, struct vcan_bus_stats *stats);
+
+#endif
+
+/**
+ * @}
+ */
@@ -0,0 +1,335 @@
+/*
+ * FreeRTOS Kernel V10.2.0
+ * Copyright (C) 2019 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * http://www.FreeRTOS.org
+ * http://aws.amazon.com/freertos
+ *
+ * 1 tab == 4 spaces!
+ */
+
+/*
+Changes from V1.0.0
+
+	+ Posix port - Host (Linux) port used by the CAN-TS simulator.
+*/
+
+/*-----------------------------------------------------------
+ * Implementation of functions defined in portable.h for the Posix port.
+ *
+ * All tasks run inside single host thread, each on its own ucontext stack
+ * carved out of the task stack buffer. There are no asynchronous signals.
+ * Instead the tick and emulated peripherals are polled every time interrupts
+ * get enabled (end of critical section, task start) and from the idle hook,
+ * which sleeps until the next tick or next requested peripheral event. Like
+ * on PicoSkyFT, yield switches context immediately, even from critical
+ * section, so critical nesting and interrupt state are saved per task. Only
+ * yield requested from emulated ISR is deferred until the ISR returns.
+ *----------------------------------------------------------*/
+
+#include <time.h>
+#include <ucontext.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+
+#if configUSE_IDLE_HOOK != 1
+#error "Posix port requires configUSE_IDLE_HOOK, idle hook is used to wait for next event"
+#endif
+
+/* Tick period in ns */
+#define portTICK_PERIOD_NS		( 1000000000ULL / configTICK_RATE_HZ )
+
+/* Execution context of one task, placed at the top of its stack buffer */
+typedef struct ThreadContext
+{
+	ucontext_t xContext;
+	TaskFunction_t pxCode;
+	void *pvParameters;
+	UBaseType_t uxCriticalNesting;
+	BaseType_t xInterruptsEnabled;
+} Thread_t;
+
+/* Current TCB. The first TCB member is pxTopOfStack, which points to Thread_t. */
+extern void * volatile pxCurrentTCB;
+
+/* Context to which vPortEndScheduler() returns */
+static ucontext_t xMainContext;
+
+static volatile BaseType_t xPortRunning = pdFALSE;
+static volatile BaseType_t xInterruptsEnabled = pdFALSE;
+static volatile BaseType_t xInISR = pdFALSE;
+static volatile BaseType_t xSwitchPending = pdFALSE;
+static volatile UBaseType_t uxCriticalNesting = 0;
+
+static uint64_t ullNextTickNs;
+static uint64_t ullWakeupNs = UINT64_MAX;
+
+static PortInterruptHandler_t pxHandlers[ portMAX_INTERRUPT_HANDLERS ];
+static UBaseType_t uxHandlerCount = 0;
+
+/*-----------------------------------------------------------*/
+
+static Thread_t *prvGetThread( void )
+{
+	return ( Thread_t * ) *( StackType_t ** ) pxCurrentTCB;
+}
+/*-----------------------------------------------------------*/
+
+uint64_t ullPortGetTimeNs( void )
+{
+struct timespec xNow;
+
+	clock_gettime( CLOCK_MONOTONIC, &xNow );
+
+	return ( uint64_t ) xNow.tv_sec * 1000000000ULL + ( uint64_t ) xNow.tv_nsec;
+}
+/*-----------------------------------------------------------*/
+
+uint64_t ullPortGetNextTickNs( void )
+{
+	return ullNextTickNs;
+}
+/*-----------------------------------------------------------*/
+
+static void prvSwitchContext( void )
+{
+Thread_t *pxOld = prvGetThread();
+Thread_t *pxNew;
+
+	/* save interrupt state of this task */
+	pxOld->uxCriticalNesting = uxCriticalNesting;
+	pxOld->xInterruptsEnabled = xInterruptsEnabled;
+	xInterruptsEnabled = pdFALSE;
+	xSwitchPending = pdFALSE;
+
+	vTaskSwitchContext();
+	pxNew = prvGetThread();
+
+	if( pxNew != pxOld )
+	{
+		swapcontext( &pxOld->xContext, &pxNew->xContext );
+	}
+
+	/* this task is running again */
+	uxCriticalNesting = pxOld->uxCriticalNesting;
+	xInterruptsEnabled = pxOld->xInterruptsEnabled;
+}
+/*-----------------------------------------------------------*/
+
+/*
+ * Emulates interrupt entry. Processes elapsed ticks and polls all registered
+ * handlers with interrupts disabled, then performs context switch if any of
+ * them requested it.
+ */
+static void prvServiceInterrupts( void )
+{
+uint64_t ullNow;
+UBaseType_t ux;
+
+	if( xPortRunning == pdFALSE || xInISR != pdFALSE || xInterruptsEnabled == pdFALSE )
+	{
+		return;
+	}
+
+	xInISR = pdTRUE;
+	xInterruptsEnabled = pdFALSE;
+	ullWakeupNs = UINT64_MAX;
+
+	ullNow = ullPortGetTimeNs();
+	while( ullNow >= ullNextTickNs )
+	{
+		if( xTaskIncrementTick() != pdFALSE )
+		{
+			xSwitchPending = pdTRUE;
+		}
+		ullNextTickNs += portTICK_PERIOD_NS;
+	}
+
+	for( ux = 0; ux < uxHandlerCount; ux++ )
+	{
+		pxHandlers[ ux ]();
+	}
+
+	xInISR = pdFALSE;
+	xInterruptsEnabled = pdTRUE;
+
+	if( xSwitchPending != pdFALSE )
+	{
+		prvSwitchContext();
+	}
+}
+/*-----------------------------------------------------------*/
+
+static void prvTaskEntry( void )
+{
+Thread_t *pxThread = prvGetThread();
+
+	/* tasks start with interrupts enabled */
+	uxCriticalNesting = 0;
+	vPortEnableInterrupts();
+
+	pxThread->pxCode( pxThread->pvParameters );
+
+	/* tasks must not return */
+	configASSERT( pdFALSE );
+}
+/*-----------------------------------------------------------*/
+
+/*
+ * See header file for description.
+ */
+StackType_t *pxPortInitialiseStack( StackType_t *pxTopOfStack, StackType_t *pxEndOfStack, TaskFunction_t pxCode, void *pvParameters )
+{
+Thread_t *pxThread;
+
+	/* place context at the top of the stack, rest of the buffer is used as stack */
+	pxThread = ( Thread_t * ) ( ( ( portPOINTER_SIZE_TYPE ) ( pxTopOfStack + 1 ) - sizeof( Thread_t ) ) &
+			~( ( portPOINTER_SIZE_TYPE ) portBYTE_ALIGNMENT_MASK ) );
+	configASSERT( ( StackType_t * ) pxThread > pxEndOfStack );
+
+	getcontext( &pxThread->xContext );
+	pxThread->xContext.uc_stack.ss_sp = pxEndOfStack;
+	pxThread->xContext.uc_stack.ss_size = ( size_t ) ( ( uint8_t * ) pxThread - ( uint8_t * ) pxEndOfStack );
+	pxThread->xContext.uc_link = NULL;
+	pxThread->pxCode = pxCode;
+	pxThread->pvParameters = pvParameters;
+	makecontext( &pxThread->xContext, prvTaskEntry, 0 );
+
+	return ( StackType_t * ) pxThread;
+}
+/*-----------------------------------------------------------*/
+
+BaseType_t xPortStartScheduler( void )
+{
+	ullNextTickNs = ullPortGetTimeNs() + portTICK_PERIOD_NS;
+	xPortRunning = pdTRUE;
+
+	/* Start the first task. vPortEndScheduler() returns here. */
+	swapcontext( &xMainContext, &prvGetThread()->xContext );
+
+	return pdTRUE;
+}
+/*-----------------------------------------------------------*/
+
+void vPortEndScheduler( void )
+{
+	xPortRunning = pdFALSE;
+	xInterruptsEnabled = pdFALSE;
+
+	setcontext( &xMainContext );
+}
+/*-----------------------------------------------------------*/
+
+void vPortYield( void )
+{
+	/* defer switch until ISR returns */
+	if( xPortRunning == pdFALSE || xInISR != pdFALSE )
+	{
+		xSwitchPending = pdTRUE;
+		return;
+	}
+
+	prvSwitchContext();
+}
+/*-----------------------------------------------------------*/
+
+void vPortDisableInterrupts( void )
+{
+	xInterruptsEnabled = pdFALSE;
+}
+/*-----------------------------------------------------------*/
+
+void vPortEnableInterrupts( void )
+{
+	/* emulated ISRs are never interrupted */
+	if( xInISR != pdFALSE )
+	{
+		return;
+	}
+
+	xInterruptsEnabled = pdTRUE;
+	prvServiceInterrupts();
+}
+/*-----------------------------------------------------------*/
+
+void vPortEnterCritical( void )
+{
+	vPortDisableInterrupts();
+	uxCriticalNesting++;
+}
+/*-----------------------------------------------------------*/
+
+void vPortExitCritical( void )
+{
+	configASSERT( uxCriticalNesting );
+
+	if( --uxCriticalNesting == 0 )
+	{
+		vPortEnableInterrupts();
+	}
+}
+/*-----------------------------------------------------------*/
+
+BaseType_t xPortRegisterInterruptHandler( PortInterruptHandler_t pxHandler )
+{
+	if( uxHandlerCount >= portMAX_INTERRUPT_HANDLERS )
+	{
+		return pdFAIL;
+	}
+
+	pxHandlers[ uxHandlerCount++ ] = pxHandler;
+
+	return pdPASS;
+}
+/*-----------------------------------------------------------*/
+
+void vPortRequestWakeup( uint64_t ullTimeNs )
+{
+	if( ullTimeNs < ullWakeupNs )
+	{
+		ullWakeupNs = ullTimeNs;
+	}
+}
+/*-----------------------------------------------------------*/
+
+/*
+ * Idle hook sleeps until the next tick or next event requested by emulated
+ * peripheral, whichever comes first. Nothing else can run in the meantime.
+ */
+void vApplicationIdleHook( void )
+{
+uint64_t ullWake, ullNow;
+struct timespec xDelay;
+
+	vPortDisableInterrupts();
+	ullWake = ( ullWakeupNs < ullNextTickNs ) ? ullWakeupNs : ullNextTickNs;
+	ullNow = ullPortGetTimeNs();
+
+	if( ullWake > ullNow )
+	{
+		xDelay.tv_sec = ( time_t ) ( ( ullWake - ullNow ) / 1000000000ULL );
+		xDelay.tv_nsec = ( long ) ( ( ullWake - ullNow ) % 1000000000ULL );
+		nanosleep( &xDelay, NULL );
+	}
+
+	vPortEnableInterrupts();
+}
+/*-----------------------------------------------------------*/
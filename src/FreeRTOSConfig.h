@@ -106,6 +106,7 @@
 #define configIDLE_SHOULD_YIELD		              0
 #define configQUEUE_REGISTRY_SIZE	              0
 #define configUSE_MUTEXES                         0
+#define configUSE_COUNTING_SEMAPHORES             1
 #define configUSE_TASK_NOTIFICATIONS              1
 #define configUSE_QUEUE_SETS                      0
 #define configUSE_POSIX_ERRNO                     0
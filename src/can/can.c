@@ -152,6 +152,14 @@ void can_enable_interrupt(struct can *base, uint8_t irq, bool enabled)
 }
 
 void can_send_packet(struct can *base, uint32_t id, uint8_t len, uint8_t *data, bool rtr, bool extended)
+{
+	struct can_frame frame;
+
+	can_encode_packet(&frame, id, len, data, rtr, extended);
+	can_send_frame(base, &frame);
+}
+
+void can_encode_packet(struct can_frame *frame, uint32_t id, uint8_t len, const uint8_t *data, bool rtr, bool extended)
 {
 	uint8_t frm;
 
@@ -161,24 +169,36 @@ void can_send_packet(struct can *base, uint32_t id, uint8_t len, uint8_t *data,
 	frm = len;
 	WriteBitsTyped(frm, CAN_FRM_FF, extended, uint8_t);
 	WriteBitsTyped(frm, CAN_FRM_RTR, rtr, uint8_t);
-	base->u.op.frm = frm;
+	frame->frm = frm;
 
 	if (extended) {
-		base->u.op.data[0] = (uint8_t)(id >> 21);
-		base->u.op.data[1] = (uint8_t)(id >> 13);
-		base->u.op.data[2] = (uint8_t)(id >> 5);
-		base->u.op.data[3] = (uint8_t)(id << 3);
+		frame->data[0] = (uint8_t)(id >> 21);
+		frame->data[1] = (uint8_t)(id >> 13);
+		frame->data[2] = (uint8_t)(id >> 5);
+		frame->data[3] = (uint8_t)(id << 3);
 	} else {
-		base->u.op.data[0] = (uint8_t)(id >> 3);
-		base->u.op.data[1] = (uint8_t)(id << 5);
+		frame->data[0] = (uint8_t)(id >> 3);
+		frame->data[1] = (uint8_t)(id << 5);
 	}
 
 	if (!rtr) {
 		if (extended)
-			memcpy((void *)&base->u.op.data[4], data, len);
+			memcpy(&frame->data[4], data, len);
 		else
-			memcpy((void *)&base->u.op.data[2], data, len);
+			memcpy(&frame->data[2], data, len);
 	}
+}
+
+void can_send_frame(struct can *base, const struct can_frame *frame)
+{
+	uint8_t frm = frame->frm;
+	uint8_t size = (frm & CAN_FRM_FF) ? 4 : 2;
+
+	if (!(frm & CAN_FRM_RTR))
+		size += frm & CAN_FRM_DLC_MSK;
+
+	/* frame register and data buffer are consecutive */
+	memcpy((void *)&base->u.op, frame, 1 + size);
 
 	base->cmr = CAN_CMR_TR;
 }
@@ -162,6 +162,18 @@ struct can {
  *@}
  */
 
+/**
+ * @struct can_frame
+ * @brief Transmit frame image, laid out as frame register and data buffer in operating mode
+ */
+struct can_frame {
+	uint8_t frm; /**< Frame information */
+	uint8_t data[12]; /**< Identifier followed by data */
+};
+/**
+ *@}
+ */
+
 /**
  * @brief Set CAN baud rate.
  * @param [in] base CAN base address.
@@ -219,6 +231,26 @@ void can_enable_interrupt(struct can *base, uint8_t irq, bool enabled);
  */
 void can_send_packet(struct can *base, uint32_t id, uint8_t len, uint8_t *data, bool rtr, bool extended);
 
+/**
+ * @brief Build CAN packet image, which can be sent later with can_send_frame().
+ * @param [out] frame Frame image
+ * @param [in] id Packet identifier
+ * @param [in] len Packet length
+ * @param [in] data Pointer to packet data
+ * @param [in] rtr Remote transmission request flag
+ * @param [in] extended Extended identifier flag. True mean 29 bit ID and false 11 bit.
+ * @retval None
+ */
+void can_encode_packet(struct can_frame *frame, uint32_t id, uint8_t len, const uint8_t *data, bool rtr, bool extended);
+
+/**
+ * @brief Send CAN packet built by can_encode_packet(). Only copies used part of image into registers.
+ * @param [in] base CAN base address.
+ * @param [in] frame Frame image
+ * @retval None
+ */
+void can_send_frame(struct can *base, const struct can_frame *frame);
+
 /**
  * @brief Receive CAN packet.
  * @param [in] base CAN base address.
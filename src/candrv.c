@@ -11,13 +11,16 @@
 
 #include <picosky/interrupt.h>
 
+#include <string.h>
+
 #include "can.h"
 #include "candrv.h"
 #include "cants.h"
 #include "FreeRTOS.h"
 #include "redundancy.h"
 #include "gpio.h"
-#include "queue.h"
+#include "sctime.h"
+#include "semphr.h"
 #include "soc.h"
 #include "task.h"
 
@@ -36,14 +39,46 @@ static const struct cants_keepalive_cfg cants_cfg = {
 	2000, /* period */
 };
 
-/* CAN trasmission queue related variables */
-static QueueHandle_t can_send_queue = NULL;
-static StaticQueue_t can_send_queue_struct;
-static uint8_t can_send_queue_buffer[CAN_SEND_QUEUE_LEN * sizeof(struct cants_msg)];
+#if CAN_SEND_QUEUE_LEN >= 128
+#error "CAN_SEND_QUEUE_LEN must be less than 128"
+#endif
+
+#if GB_TX_RESERVE + GB_TX_RESUME > CAN_SEND_QUEUE_LEN
+#error "GB_TX_RESERVE + GB_TX_RESUME must not be bigger than CAN_SEND_QUEUE_LEN"
+#endif
+
+/**
+ * @struct can_send_entry
+ * @brief Entry in CAN transmission queue
+ */
+struct can_send_entry {
+	struct can_frame frame; /**< frame image, built by cants_send_msg(), so TX interrupt only copies it */
+	uint8_t order; /**< insertion order, keeps frames with equal CAN ID in FIFO order */
+};
+/**
+ *@}
+ */
+
+/*
+ * CAN trasmission queue related variables. Queue is a binary min-heap of entry
+ * indices ordered by CAN ID, so frames leave in the same order as bus
+ * arbitration would pick them. Indices of free entries follow the heap, so
+ * entries stay in place and only indices move. Semaphore counts free entries,
+ * tasks wait on it when queue is full.
+ */
+static struct can_send_entry can_send_queue_buffer[CAN_SEND_QUEUE_LEN];
+static uint8_t can_send_heap[CAN_SEND_QUEUE_LEN];
+static uint8_t can_send_count;
+static uint8_t can_send_order;
+static SemaphoreHandle_t can_send_slots = NULL;
+static StaticSemaphore_t can_send_queue_struct;
 
 /* holds reference to currently active CAN controller */
 static struct can *current_ctrl;
 
+/* driver statistics, updated with interrupts disabled */
+static struct candrv_stats stats;
+
 /**
  * @brief Initializes CAN controller
  * @param [in] base base address of CAN controller
@@ -54,10 +89,103 @@ static void candrv_init_ctrl(struct can *base)
 	can_reset_mode(base, true);
 	can_set_baudrate(base, 1000000, 0);
 	can_set_rx_filter(base, 0, 0x7EUL << 21, true);
-	can_enable_interrupt(base, CAN_IRQ_RI | CAN_IRQ_TI | CAN_IRQ_BEI | CAN_IRQ_EPI | CAN_IRQ_EI, true);
+	can_enable_interrupt(base, CAN_IRQ_RI | CAN_IRQ_TI | CAN_IRQ_DOI | CAN_IRQ_BEI | CAN_IRQ_EPI | CAN_IRQ_EI, true);
 	can_reset_mode(base, false);
 }
 
+/**
+ * @brief Compare CAN transmission queue entries
+ * @param [in] a index of first entry
+ * @param [in] b index of second entry
+ * @retval 1 if a must be sent before b, 0 otherwise
+ */
+static uint8_t can_send_before(uint8_t a, uint8_t b)
+{
+	/* extended ID is stored big-endian and left aligned, so its bytes compare as CAN IDs */
+	int cmp = memcmp(can_send_queue_buffer[a].frame.data, can_send_queue_buffer[b].frame.data, 4);
+
+	/* lower CAN ID wins arbitration, order wraps, but queue is much shorter than 128 */
+	return cmp < 0 || (cmp == 0 && (int8_t)(can_send_queue_buffer[a].order - can_send_queue_buffer[b].order) < 0);
+}
+
+/**
+ * @brief Put frame in CAN transmission queue. Must be called with interrupts
+ * disabled and with free entry taken from can_send_slots.
+ * @param [in] frame frame image
+ * @retval None
+ */
+static void can_send_push(const struct can_frame *frame)
+{
+	uint8_t i = can_send_count++, parent, entry;
+
+	cants_assert(i < CAN_SEND_QUEUE_LEN);
+
+	/* first free entry follows the heap */
+	entry = can_send_heap[i];
+	can_send_queue_buffer[entry].frame = *frame;
+	can_send_queue_buffer[entry].order = can_send_order++;
+
+	/* sift up */
+	while (i) {
+		parent = (i - 1) / 2;
+		if (!can_send_before(entry, can_send_heap[parent]))
+			break;
+		can_send_heap[i] = can_send_heap[parent];
+		i = parent;
+	}
+	can_send_heap[i] = entry;
+}
+
+/**
+ * @brief Take frame with lowest CAN ID from CAN transmission queue. Must be
+ * called with interrupts disabled, which must stay disabled until the frame is copied.
+ * @retval frame image or NULL if queue is empty
+ */
+static const struct can_frame *can_send_pop(void)
+{
+	uint8_t i = 0, child, first, last;
+
+	if (!can_send_count)
+		return NULL;
+
+	first = can_send_heap[0];
+	last = can_send_heap[--can_send_count];
+
+	/* sift down */
+	while ((child = 2 * i + 1) < can_send_count) {
+		if (child + 1 < can_send_count && can_send_before(can_send_heap[child + 1], can_send_heap[child]))
+			child++;
+		if (!can_send_before(can_send_heap[child], last))
+			break;
+		can_send_heap[i] = can_send_heap[child];
+		i = child;
+	}
+	can_send_heap[i] = last;
+
+	/* entry is free now, it is overwritten only by next push */
+	can_send_heap[can_send_count] = first;
+
+	return &can_send_queue_buffer[first].frame;
+}
+
+/**
+ * @brief Move queued frames to controller for as long as it has free transmit
+ * buffer. Must be called from ISR or from critical section.
+ * @param [in] base base address of CAN controller
+ * @param [out] yield set to pdTRUE if task waiting on send queue was woken
+ * @retval None
+ */
+static void candrv_tx_drain(struct can *base, BaseType_t *yield)
+{
+	const struct can_frame *frame;
+
+	/* TBS is checked first, so frame is never written over one being sent */
+	while ((can_get_status(base) & CAN_SR_TBS) && (frame = can_send_pop())) {
+		can_send_frame(base, frame);
+		xSemaphoreGiveFromISR(can_send_slots, yield);
+	}
+}
+
 /**
  * @brief CAN interrupt handler
  * @param [in] base base address of CAN controller
@@ -68,31 +196,59 @@ static void can_int_handler(struct can *base)
 	uint8_t active = current_ctrl == base;
 	uint8_t ir = can_get_int_status(base);
 	BaseType_t yield = pdFALSE;
-	struct cants_msg msg;
+	struct cants_msg *msg;
+	uint8_t rx = ir & CAN_IRQ_RI;
+	/* taken before TX handling, as close to reception of first frame as possible */
+	uint32_t time = rx ? sctime_local() : 0;
+	uint8_t first = 1;
 
-	/* Transmit buffer in CAN controller is empty, so we can send new message */
+	/* Transmit buffer in CAN controller is empty, so we can send new messages */
 	if (active && (ir & CAN_IRQ_TI)) {
-		if (xQueueReceiveFromISR(can_send_queue, &msg, &yield) == pdTRUE)
-			can_send_packet(base, cants_construct_id(&msg), msg.length, msg.data, 0, true);
+		candrv_tx_drain(base, &yield);
+		yield |= cants_tx_done_isr(CAN_SEND_QUEUE_LEN - can_send_count);
 	}
 
 	/* Message from CAN bus has been received */
-	if (ir & CAN_IRQ_RI) {
+	if (rx) {
+		struct cants_msg scratch;
 		bool ext, rtr;
 		uint32_t id;
 
 		/* read all messages from FIFO */
 		while (can_get_status(base) & CAN_SR_RBS) {
-			can_recv_packet(base, &id, &msg.length, msg.data, &rtr, &ext);
+			/* first frame raised the interrupt, later ones are stamped when read out of FIFO */
+			if (!first)
+				time = sctime_local();
+			first = 0;
+
+			/* when pool is exhausted, frame still has to be read out and is dropped */
+			msg = cants_msg_alloc_isr();
+			can_recv_packet(base, &id, msg ? &msg->length : &scratch.length,
+					msg ? msg->data : scratch.data, &rtr, &ext);
+
+			if (!msg) {
+				stats.rx_no_msg++;
+				continue;
+			}
 
 			/* validate CAN frame */
 			if (active && ext && !rtr) {
-				cants_parse_id(&msg, id);
-				yield |= cants_dispatch_isr(&msg);
+				cants_parse_id(msg, id);
+				cants_msg_set_time(msg, time);
+				cants_trace(cants_trace_rx_isr, msg);
+				yield |= cants_dispatch_isr(msg);
+			} else {
+				cants_msg_free_isr(msg);
 			}
 		}
 	}
 
+	/* FIFO filled up before it was read out, status must be cleared after it is empty again */
+	if ((ir & CAN_IRQ_DOI) || (can_get_status(base) & CAN_SR_DOS)) {
+		stats.rx_overrun[base != CAN0]++;
+		can_command(base, CAN_CMR_CDO);
+	}
+
 	/* reinitialize controller in case of error */
 	if (ir & (CAN_IRQ_BEI | CAN_IRQ_EPI | CAN_IRQ_EI))
 		candrv_init_ctrl(base);
@@ -129,27 +285,73 @@ void candrv_set_bus(uint8_t bus)
 uint8_t cants_send_msg(struct cants_msg *msg, uint8_t wait_allowed)
 {
 	TickType_t wait_time = wait_allowed ? pdMS_TO_TICKS(10) : 0;
+	BaseType_t yield = pdFALSE;
+	struct can_frame frame;
 	uint8_t ret = 1;
 
-	/* if TX buffer is empty, send CAN frame directly, otherwise put in queue */
+	cants_trace(cants_trace_send, msg);
+
+	/* image is built with interrupts enabled and queued by value, so message stays with caller */
+	can_encode_packet(&frame, cants_construct_id(msg), msg->length, msg->data, 0, true);
+
 	taskENTER_CRITICAL();
-	if (can_get_status(current_ctrl) & CAN_SR_TBS)
-		can_send_packet(current_ctrl, cants_construct_id(msg), msg->length, msg->data, 0, true);
-	else if (xQueueSendToBack(can_send_queue, msg, wait_time) == errQUEUE_FULL)
-		ret = 0;
+
+	/* queued frames go first, in case TX interrupt hasn't run yet */
+	candrv_tx_drain(current_ctrl, &yield);
+
+	/* if TX buffer is still empty, send CAN frame directly, otherwise put in queue */
+	if (can_get_status(current_ctrl) & CAN_SR_TBS) {
+		can_send_frame(current_ctrl, &frame);
+		stats.tx_direct++;
+	} else {
+		if (xSemaphoreTake(can_send_slots, wait_time) != pdTRUE)
+			ret = 0;
+		else
+			can_send_push(&frame);
+
+		if (ret) {
+			stats.tx_queued++;
+			if (can_send_count > stats.tx_queue_hwm)
+				stats.tx_queue_hwm = can_send_count;
+		} else {
+			stats.tx_dropped++;
+		}
+	}
 	taskEXIT_CRITICAL();
 
+	/* drained queue could have woken task waiting for free entry */
+	if (yield)
+		taskYIELD();
+
 	return ret;
 }
 
+uint8_t cants_send_free(void)
+{
+	/* single byte is read atomically */
+	return CAN_SEND_QUEUE_LEN - can_send_count;
+}
+
+void candrv_get_stats(struct candrv_stats *out)
+{
+	taskENTER_CRITICAL();
+	*out = stats;
+	taskEXIT_CRITICAL();
+}
+
 void candrv_init(void)
 {
-	/* initialize CAN output queue */
-	can_send_queue = xQueueCreateStatic(CAN_SEND_QUEUE_LEN, sizeof(struct cants_msg),
-						 can_send_queue_buffer, &can_send_queue_struct);
+	uint8_t i;
+
+	/* initialize CAN output queue, all entries are free */
+	for (i = 0; i < CAN_SEND_QUEUE_LEN; i++)
+		can_send_heap[i] = i;
+	can_send_slots = xSemaphoreCreateCountingStatic(CAN_SEND_QUEUE_LEN, CAN_SEND_QUEUE_LEN,
+						 &can_send_queue_struct);
 
-	/* initialize redundancy mechanism */
+	/* initialize redundancy mechanism and time service */
 	redundancy_init();
+	sctime_init();
 
 	/* init CAN-TS stack */
 	cants_init(&cants_cfg);
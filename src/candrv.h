@@ -16,12 +16,35 @@
 /* length of CAN send queue */
 #define CAN_SEND_QUEUE_LEN 16
 
+/**
+ * @struct candrv_stats
+ * @brief CAN driver statistics
+ */
+struct candrv_stats {
+	uint32_t tx_direct; /**< frames written to CAN controller directly by cants_send_msg() */
+	uint32_t tx_queued; /**< frames put into CAN send queue */
+	uint32_t tx_dropped; /**< frames not sent, because CAN send queue was full */
+	uint32_t rx_overrun[2]; /**< RX FIFO data overruns of CAN0 and CAN1, each one lost at least one frame */
+	uint32_t rx_no_msg; /**< received frames dropped, because message pool was exhausted */
+	uint8_t tx_queue_hwm; /**< maximum number of frames waiting in CAN send queue */
+};
+/**
+ *@}
+ */
+
 /**
  * @brief Initialize CAN-TS stack and CAN controller
  * @retval None
  */
 void candrv_init(void);
 
+/**
+ * @brief Get CAN driver statistics
+ * @param [out] out statistics
+ * @retval None
+ */
+void candrv_get_stats(struct candrv_stats *out);
+
 /**
  * @brief Switch currently active CAN bus
  * @param [in] bus 0 means primary bus, anything else means secondary bus
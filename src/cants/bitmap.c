@@ -0,0 +1,124 @@
+/**
+ * @file bitmap.c
+ *
+ */
+
+/**
+ * @addtogroup CAN-TS
+ * @{
+ */
+
+#include "bitmap.h"
+
+/** index of lowest set bit in nibble, 4 for empty one */
+static const uint8_t bitmap_nibble_ctz[16] = { 4, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0 };
+
+/**
+ * @brief Find index of lowest set bit, 8-bit MCU has no such instruction
+ * @param [in] word non-zero word
+ * @retval bit index
+ */
+static uint8_t bitmap_ctz(BITMAP_WORD word)
+{
+	uint8_t n = 0;
+
+	/* skip empty bytes, then empty nibble */
+	while (!(word & 0xffU)) {
+		word >>= 8;
+		n += 8;
+	}
+	if (!(word & 0x0fU)) {
+		word >>= 4;
+		n += 4;
+	}
+
+	return n + bitmap_nibble_ctz[word & 0x0fU];
+}
+
+/**
+ * @brief Mask of bits from given bit to the top of the word
+ * @param [in] bit bit index within word
+ * @retval mask
+ */
+static BITMAP_WORD bitmap_mask_from(uint8_t bit)
+{
+	return (BITMAP_WORD)~(BITMAP_WORD)0 << bit;
+}
+
+/**
+ * @brief Find next bit, which differs from bits in invert
+ * @param [in] map bitmap
+ * @param [in] from index of first bit to check
+ * @param [in] bits number of bits in bitmap
+ * @param [in] invert 0 to find set bit, all ones to find cleared bit
+ * @retval bit index, bits if there is none
+ */
+static uint8_t bitmap_next(const BITMAP_WORD *map, uint8_t from, uint8_t bits, BITMAP_WORD invert)
+{
+	uint8_t i = from / BITMAP_WORD_BITS, words = BITMAP_WORDS(bits);
+	BITMAP_WORD word;
+
+	if (from >= bits)
+		return bits;
+
+	/* whole words which don't hold the bit are skipped */
+	word = (map[i] ^ invert) & bitmap_mask_from(from % BITMAP_WORD_BITS);
+	while (!word) {
+		if (++i >= words)
+			return bits;
+		word = map[i] ^ invert;
+	}
+
+	from = i * BITMAP_WORD_BITS + bitmap_ctz(word);
+
+	return from < bits ? from : bits;
+}
+
+uint8_t bitmap_next_set(const BITMAP_WORD *map, uint8_t from, uint8_t bits)
+{
+	return bitmap_next(map, from, bits, 0);
+}
+
+uint8_t bitmap_next_clear(const BITMAP_WORD *map, uint8_t from, uint8_t bits)
+{
+	return bitmap_next(map, from, bits, (BITMAP_WORD)~(BITMAP_WORD)0);
+}
+
+uint8_t bitmap_full(const BITMAP_WORD *map, uint8_t bits)
+{
+	uint8_t i, words = bits / BITMAP_WORD_BITS;
+	BITMAP_WORD last;
+
+	for (i = 0; i < words; i++)
+		if (map[i] != (BITMAP_WORD)~(BITMAP_WORD)0)
+			return 0;
+
+	/* last word is compared only up to the last bit */
+	bits %= BITMAP_WORD_BITS;
+	last = (BITMAP_WORD)~bitmap_mask_from(bits);
+
+	return !bits || (map[i] & last) == last;
+}
+
+void bitmap_from_bytes(BITMAP_WORD *map, const uint8_t *data, uint8_t length)
+{
+	uint8_t i;
+
+	for (i = 0; i < BITMAP_WORDS(length * 8U); i++)
+		map[i] = 0;
+
+	for (i = 0; i < length; i++)
+		map[i / sizeof(BITMAP_WORD)] |= (BITMAP_WORD)data[i] << (i % sizeof(BITMAP_WORD) * 8);
+}
+
+void bitmap_to_bytes(const BITMAP_WORD *map, uint8_t *data, uint8_t length)
+{
+	uint8_t i;
+
+	for (i = 0; i < length; i++)
+		data[i] = map[i / sizeof(BITMAP_WORD)] >> (i % sizeof(BITMAP_WORD) * 8);
+}
+
+/**
+ * @}
+ */
@@ -0,0 +1,99 @@
+/**
+ * @file bitmap.h
+ *
+ */
+
+/**
+ * @addtogroup CAN-TS
+ * @{
+ */
+
+#ifndef BITMAP_H_
+#define BITMAP_H_
+
+#include "cants.h"
+
+/** number of bits in one bitmap word */
+#define BITMAP_WORD_BITS (sizeof(BITMAP_WORD) * 8U)
+
+/** number of words in bitmap of given number of bits */
+#define BITMAP_WORDS(bits) (((bits) + BITMAP_WORD_BITS - 1) / BITMAP_WORD_BITS)
+
+/*
+ * Bitmaps are arrays of BITMAP_WORD. Bit n is bit n % BITMAP_WORD_BITS of
+ * word n / BITMAP_WORD_BITS, so on the wire, where bit n is bit n % 8 of
+ * byte n / 8, bitmap is converted with bitmap_from_bytes() and
+ * bitmap_to_bytes() independently of word size and endianness.
+ */
+
+/**
+ * @brief Set bit
+ * @param [in] map bitmap
+ * @param [in] bit bit index
+ * @retval None
+ */
+static inline void bitmap_set(BITMAP_WORD *map, uint8_t bit)
+{
+	map[bit / BITMAP_WORD_BITS] |= (BITMAP_WORD)1 << (bit % BITMAP_WORD_BITS);
+}
+
+/**
+ * @brief Test bit
+ * @param [in] map bitmap
+ * @param [in] bit bit index
+ * @retval non-zero if bit is set, 0 otherwise
+ */
+static inline uint8_t bitmap_test(const BITMAP_WORD *map, uint8_t bit)
+{
+	return (map[bit / BITMAP_WORD_BITS] >> (bit % BITMAP_WORD_BITS)) & 1U;
+}
+
+/**
+ * @brief Find next set bit
+ * @param [in] map bitmap
+ * @param [in] from index of first bit to check
+ * @param [in] bits number of bits in bitmap
+ * @retval index of first set bit not below from, bits if there is none
+ */
+uint8_t bitmap_next_set(const BITMAP_WORD *map, uint8_t from, uint8_t bits);
+
+/**
+ * @brief Find next cleared bit
+ * @param [in] map bitmap
+ * @param [in] from index of first bit to check
+ * @param [in] bits number of bits in bitmap
+ * @retval index of first cleared bit not below from, bits if there is none
+ */
+uint8_t bitmap_next_clear(const BITMAP_WORD *map, uint8_t from, uint8_t bits);
+
+/**
+ * @brief Check if all bits are set
+ * @param [in] map bitmap
+ * @param [in] bits number of bits in bitmap
+ * @retval 1 if bits from 0 to bits-1 are set, 0 otherwise
+ */
+uint8_t bitmap_full(const BITMAP_WORD *map, uint8_t bits);
+
+/**
+ * @brief Convert bytes, as sent on the bus, to bitmap
+ * @param [out] map bitmap, BITMAP_WORDS(length * 8) words are written
+ * @param [in] data bytes
+ * @param [in] length number of bytes
+ * @retval None
+ */
+void bitmap_from_bytes(BITMAP_WORD *map, const uint8_t *data, uint8_t length);
+
+/**
+ * @brief Convert bitmap to bytes, as sent on the bus
+ * @param [in] map bitmap
+ * @param [out] data bytes
+ * @param [in] length number of bytes
+ * @retval None
+ */
+void bitmap_to_bytes(const BITMAP_WORD *map, uint8_t *data, uint8_t length);
+
+#endif
+
+/**
+ * @}
+ */
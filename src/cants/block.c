@@ -10,10 +10,29 @@
 
 #include <string.h>
 
+#include "bitmap.h"
 #include "block.h"
 #include "FreeRTOS.h"
 #include "queue.h"
 #include "task.h"
+#include "deadline.h"
+
+#if SB_WINDOW_FRAMES > BLOCK_MAX_FRAMES || GB_WINDOW_FRAMES > BLOCK_MAX_FRAMES
+#error "SB_WINDOW_FRAMES and GB_WINDOW_FRAMES must not be bigger than BLOCK_MAX_FRAMES"
+#endif
+
+#if MAX_SB_SESSIONS > 16 || MAX_GB_SESSIONS > 16
+#error "MAX_SB_SESSIONS and MAX_GB_SESSIONS must not be bigger than 16"
+#endif
+
+/** number of buffers in Get Block session, second one holds read-ahead window */
+#define GB_BUFFERS (GB_READ_AHEAD + 1)
+
+/** size of buffer leased from arena, holds one SB or GB window */
+#define BLOCK_BUFFER_SIZE ((SB_WINDOW_FRAMES > GB_WINDOW_FRAMES ? SB_WINDOW_FRAMES : GB_WINDOW_FRAMES) * 8)
+
+/** size of source ID to session index, two 4-bit entries per byte */
+#define BLOCK_INDEX_SIZE 128
 
 /**
  * @enum sb_state
@@ -35,6 +54,7 @@ enum sb_state {
  */
 enum gb_state {
 	gb_state_idle = 0, /**< Idle state, new request is possible */
+	gb_state_reading, /**< Session open, data is being read into buffer */
 	gb_state_wait_on_start, /**< Session open, waiting on start packet */
 	gb_state_transmitting, /**< Transmitting state */
 };
@@ -47,16 +67,19 @@ enum gb_state {
  * @brief Holds state of one Set Block session
  */
 struct sb_session {
-	uint8_t buffer[512]; /**< intermediate buffer to hold data during trasmission */
-	uint8_t mask[8]; /**< bitmap, represents which packet has been received */
+	uint8_t *buffer; /**< intermediate buffer to hold data during trasmission, leased from arena, NULL if none */
+	BITMAP_WORD mask[BITMAP_WORDS(SB_WINDOW_FRAMES)]; /**< bitmap, represents which packet has been received */
 	ADDRESS_TYPE address; /**< destination address */
-	TimeOut_t timeout_state; /**< time of last valid received packet */
-	TickType_t timeout; /**< remaining time before session expires */
+	struct cants_deadline timer; /**< session expiry, or when to check if data has been written */
 	uint8_t source; /**< node ID of initiator of this Set Block session */
 	uint8_t state; /**< current state of this session, one of ::sb_state */
 	uint8_t max_seq; /**< Maximum sequence number in this session */
 	uint8_t last_blk_size; /**< Size of last block */
 	uint8_t done; /**< Marks if data has been written */
+	uint8_t rearm; /**< valid frame was received, timeout is reset after current batch of frames */
+#if SB_STREAMING_WRITE
+	uint8_t streamed; /**< number of blocks from start of window passed to stream handler */
+#endif
 };
 /**
  *@}
@@ -67,14 +90,20 @@ struct sb_session {
  * @brief Holds state of one Get Block session
  */
 struct gb_session {
-	uint8_t buffer[512]; /**< intermediate buffer to hold data during trasmission */
-	uint8_t mask[8]; /**<  bitmap, represents which packet to send */
-	TimeOut_t timeout_state; /**< time of last valid received packet */
-	TickType_t timeout; /**< remaining time before session expires or when to send new data burst */
+	uint8_t *buffer[GB_BUFFERS]; /**< intermediate buffers to hold data during trasmission, leased from arena, NULL if none */
+	BITMAP_WORD mask[BITMAP_WORDS(GB_WINDOW_FRAMES)]; /**<  bitmap, represents which packet to send */
+	ADDRESS_TYPE address; /**< source address of current window */
+	struct cants_deadline timer; /**< session expiry, or when to send new data burst or check read */
 	uint8_t source; /**< node ID of initiator of this get Block session */
 	uint8_t state; /**< current state of this session, one of ::gb_state */
 	uint8_t max_seq; /**< Maximum sequence number in this session */
 	uint8_t cur_seq; /**< Sequence number of next block sent */
+	uint8_t done[GB_BUFFERS]; /**< Marks if data has been read into corresponding buffer */
+	uint8_t cur; /**< index of buffer, which holds current window */
+	uint8_t started; /**< Marks if start packet was received while reading */
+#if GB_READ_AHEAD
+	uint8_t ahead_frames; /**< number of frames of next window being read into other buffer, 0 if none */
+#endif
 };
 /**
  *@}
@@ -83,11 +112,11 @@ struct gb_session {
 /* Set & Get block queue related buffers */
 static QueueHandle_t setblock_queue = NULL;
 static StaticQueue_t setblock_queue_struct;
-static uint8_t setblock_queue_buffer[SETBLOCK_QUEUE_LEN * sizeof(struct cants_msg)];
+static uint8_t setblock_queue_buffer[SETBLOCK_QUEUE_LEN * sizeof(struct cants_msg *)];
 
 static QueueHandle_t getblock_queue = NULL;
 static StaticQueue_t getblock_queue_struct;
-static uint8_t getblock_queue_buffer[GETBLOCK_QUEUE_LEN * sizeof(struct cants_msg)];
+static uint8_t getblock_queue_buffer[GETBLOCK_QUEUE_LEN * sizeof(struct cants_msg *)];
 
 /* Set & Get block task related buffers */
 static StaticTask_t getblock_task_buffer;
@@ -100,6 +129,34 @@ static StackType_t setblock_task_stack[SETBLOCK_STACK_SIZE];
 static struct sb_session sb_sessions[MAX_SB_SESSIONS];
 static struct gb_session gb_sessions[MAX_GB_SESSIONS];
 
+/*
+ * Arena of transfer buffers shared by Set & Get Block sessions. Buffers are
+ * leased when request is accepted and returned when session ends, so idle
+ * sessions don't hold any window sized RAM.
+ */
+static uint8_t block_arena[BLOCK_ARENA_BUFFERS][BLOCK_BUFFER_SIZE];
+static uint8_t *block_arena_free[BLOCK_ARENA_BUFFERS];
+static uint8_t block_arena_free_count;
+
+/*
+ * Index of last session opened by each source node ID. Entry is only a hint,
+ * session is matched if it is still active and belongs to the same source, so
+ * entries don't have to be cleared when session ends. Each table is written
+ * only by its own task.
+ */
+static uint8_t sb_session_index[BLOCK_INDEX_SIZE];
+static uint8_t gb_session_index[BLOCK_INDEX_SIZE];
+
+/* session timeouts of Set & Get Block tasks, earliest one is always on top */
+static struct cants_deadline *sb_deadline_heap[MAX_SB_SESSIONS];
+static struct cants_deadlines sb_deadlines;
+static struct cants_deadline *gb_deadline_heap[MAX_GB_SESSIONS];
+static struct cants_deadlines gb_deadlines;
+
+/* set when GB burst stopped on full CAN transmission queue, and when TX interrupt resumed it */
+static volatile uint8_t gb_tx_wait;
+static volatile uint8_t gb_tx_ready;
+
 /**
  * @brief Validates received address and copy it into session state
  * @param [in] msg Received CAN-TS frame
@@ -118,80 +175,88 @@ static uint8_t block_copy_address(struct cants_msg *msg, ADDRESS_TYPE *address)
 }
 
 /**
- * @brief Sets bit in a bitmap
- * @param [in] mask Bitmap array
- * @param [in] position Bit position to set to 1
- * @retval None
+ * @brief Validate received mask and convert it to session bitmap
+ * @param [out] mask session bitmap, only words covering blk_count bits are written
+ * @param [in] data Buffer with mask data
+ * @param [in] length Length of received mask array in bytes
+ * @param [in] blk_count Block count in this session
+ * @retval 1 if mask is valid, 0 otherwise
  */
-static void block_update_mask(uint8_t *mask, uint8_t position)
+static uint8_t block_validate_mask(BITMAP_WORD *mask, const uint8_t *data, uint8_t length, uint8_t blk_count)
 {
-	mask[position / 8] |= 1U << (position % 8);
+	BITMAP_WORD received[BITMAP_WORDS(BLOCK_MAX_FRAMES)];
+
+	/* check if mask is too short, or longer than CAN frame */
+	if (length < (blk_count + 7) / 8 || length > BLOCK_MAX_FRAMES / 8)
+		return 0;
+
+	/* bits higher than max. block number must not be set, even if mask is longer than it needs to be */
+	bitmap_from_bytes(received, data, length);
+	if (bitmap_next_set(received, blk_count, length * 8) < length * 8)
+		return 0;
+
+	memcpy(mask, received, BITMAP_WORDS(blk_count) * sizeof(BITMAP_WORD));
+
+	return 1;
 }
 
 /**
- * @brief Checks if bit is set in a bitmap
- * @param [in] mask Bitmap array
- * @param [in] sequence Number of the bit to check
- * @retval 0 if bit is not set, any other value means bit is set
+ * @brief Lease transfer buffer from arena
+ * @retval pointer to buffer or NULL if arena is exhausted
  */
-static uint8_t block_check_seq_in_mask(uint8_t *mask, uint8_t sequence)
+static uint8_t *block_buffer_alloc(void)
 {
-	return mask[sequence / 8] & (1U << (sequence % 8));
+	uint8_t *buffer = NULL;
+
+	taskENTER_CRITICAL();
+	if (block_arena_free_count)
+		buffer = block_arena_free[--block_arena_free_count];
+	taskEXIT_CRITICAL();
+
+	return buffer;
 }
 
 /**
- * @brief Checks if all bits from 0 to blk_count-1 are set in a mask
- * @param [in] mask Bitmap array
- * @param [in] blk_count Number of blocks to check
- * @retval 1 if all blocks are received, 0 otherwise
+ * @brief Return transfer buffer to arena
+ * @param [in] buffer buffer leased with block_buffer_alloc()
+ * @retval None
  */
-static uint8_t block_check_fully_received(uint8_t *mask, uint8_t blk_count)
+static void block_buffer_free(uint8_t *buffer)
 {
-	uint8_t tmp;
-
-	tmp = blk_count / 8;
-	while (tmp--)
-		if (*mask++ != 0xff)
-			return 0;
-
-	tmp = blk_count % 8;
-	if (tmp && *mask != ((1U << tmp) - 1))
-		return 0;
+	taskENTER_CRITICAL();
+	cants_assert(block_arena_free_count < BLOCK_ARENA_BUFFERS);
+	block_arena_free[block_arena_free_count++] = buffer;
+	taskEXIT_CRITICAL();
+}
 
-	return 1;
+uint8_t block_arena_free_buffers(void)
+{
+	return block_arena_free_count;
 }
 
 /**
- * @brief Validate received mask
- * @param [in] data Buffer with mask data
- * @param [in] length Length of received mask array in bytes
- * @param [in] blk_count Block count in this session
- * @retval 1 if mask is valid, 0 otherwise
+ * @brief Get session index of source node ID
+ * @param [in] index source ID to session index table
+ * @param [in] source source node ID
+ * @retval session index
  */
-static uint8_t block_validate_mask(uint8_t *data, uint8_t length, uint8_t blk_count)
+static uint8_t block_index_get(const uint8_t *index, uint8_t source)
 {
-	uint8_t tmp, i;
-
-	/* check if mask is too short */
-	if (length < (blk_count + 7) / 8)
-		return 0;
-
-	tmp = blk_count % 8;
-	i = blk_count / 8;
-
-	/* check if bits higher than max. block number are set */
-	if (tmp) {
-		if (data[i] & ~((1U << tmp) - 1))
-			return 0;
-		++i;
-	}
+	return (index[source >> 1] >> ((source & 1) * 4)) & 0x0f;
+}
 
-	/* If mask is longer than it needs to be, higher bytes have to be 0. */
-	while (i++ < length)
-		if (data[i])
-			return 0;
+/**
+ * @brief Set session index of source node ID
+ * @param [in] index source ID to session index table
+ * @param [in] source source node ID
+ * @param [in] session session index
+ * @retval None
+ */
+static void block_index_set(uint8_t *index, uint8_t source, uint8_t session)
+{
+	uint8_t shift = (source & 1) * 4;
 
-	return 1;
+	index[source >> 1] = (index[source >> 1] & ~(0x0f << shift)) | (session << shift);
 }
 
 /**
@@ -201,20 +266,50 @@ static uint8_t block_validate_mask(uint8_t *data, uint8_t length, uint8_t blk_co
  */
 static struct sb_session *block_get_sb_session(struct cants_msg *msg)
 {
-	uint8_t i;
+	uint8_t source = cants_msg_src(msg), i = block_index_get(sb_session_index, source);
+	struct sb_session *session;
 
-	for (i = 0; i < MAX_SB_SESSIONS; ++i) {
-		struct sb_session *session = &sb_sessions[i];
+	if (i >= MAX_SB_SESSIONS)
+		return NULL;
 
-		/* match session based on source ID */
-		if (session->source == msg->source &&
-			session->state != sb_state_idle)
-			return session;
-	}
+	/* match session based on source ID */
+	session = &sb_sessions[i];
+	if (session->source == source && session->state != sb_state_idle)
+		return session;
 
 	return NULL;
 }
 
+/**
+ * @brief Return buffer of idle Set Block session to arena, unless it's still being written
+ * @param [in] session session state
+ * @retval None
+ */
+static void block_sb_reclaim(struct sb_session *session)
+{
+	if (session->state == sb_state_idle && session->buffer && session->done) {
+		block_buffer_free(session->buffer);
+		session->buffer = NULL;
+	}
+}
+
+/**
+ * @brief End Set Block session and return its buffer to arena
+ * @param [in] session session state
+ * @retval None
+ */
+static void block_sb_close(struct sb_session *session)
+{
+	if (session->state == sb_state_idle)
+		return;
+
+	/* only write handler may still use buffer */
+	if (session->state != sb_state_writing)
+		session->done = 1;
+	session->state = sb_state_idle;
+	block_sb_reclaim(session);
+}
+
 /**
  * @brief Find free slot for new Set Block session
  * @retval pointer to a new session state if available, NULL otherwise
@@ -226,13 +321,31 @@ static struct sb_session *block_new_sb_session(void)
 	for (i = 0; i < MAX_SB_SESSIONS; ++i) {
 		struct sb_session *session = &sb_sessions[i];
 
-		if (session->state == sb_state_idle)
+		/* buffer of session aborted while writing is returned once write handler is done */
+		block_sb_reclaim(session);
+		if (session->state == sb_state_idle && !session->buffer)
 			return session;
 	}
 
 	return NULL;
 }
 
+/**
+ * @brief Move Set Block session, whose window is written, to done state. Finished
+ * session needs no buffer, so it is returned to arena, continue request leases it again.
+ * @param [in] session session state
+ * @retval None
+ */
+static void block_sb_finish(struct sb_session *session)
+{
+	if (session->state != sb_state_writing || !session->done)
+		return;
+
+	session->state = sb_state_done;
+	block_buffer_free(session->buffer);
+	session->buffer = NULL;
+}
+
 /**
  * @brief Sets new timeout for Set Block session, based on state
  * @param [in] session session state
@@ -240,10 +353,9 @@ static struct sb_session *block_new_sb_session(void)
  */
 static void block_sb_reset_timeout(struct sb_session *session)
 {
-	vTaskSetTimeOutState(&session->timeout_state);
 	/* when writing data, value of "done" field has to be checked more often */
-	session->timeout = (session->state == sb_state_writing) ?
-		pdMS_TO_TICKS(SB_WRITING_INTERVAL) : pdMS_TO_TICKS(SB_TIMEOUT);
+	cants_deadline_arm(&sb_deadlines, &session->timer, (session->state == sb_state_writing) ?
+		pdMS_TO_TICKS(SB_WRITING_INTERVAL) : pdMS_TO_TICKS(SB_TIMEOUT));
 }
 
 /**
@@ -254,12 +366,183 @@ static void block_sb_reset_timeout(struct sb_session *session)
 static void block_sb_timeout(struct sb_session *session)
 {
 	if (session->state == sb_state_writing) {
-		if (session->done)
-			session->state = sb_state_done;
+		block_sb_finish(session);
 		block_sb_reset_timeout(session);
 	} else {
-		session->state = sb_state_idle;
+		block_sb_close(session);
+	}
+}
+
+#if SB_STREAMING_WRITE
+/**
+ * @brief Pass blocks, which follow already streamed ones without gaps, to stream handler
+ * @param [in] session session state
+ * @retval None
+ */
+static void block_sb_stream(struct sb_session *session)
+{
+	uint8_t first = session->streamed;
+	uint16_t size;
+
+	session->streamed = bitmap_next_clear(session->mask, session->streamed, session->max_seq + 1);
+
+	if (session->streamed == first)
+		return;
+
+	size = (uint16_t)(session->streamed - first) * 8;
+
+	/* last block may be of different length, window is complete after it */
+	if (session->streamed > session->max_seq) {
+		size -= 8 - session->last_blk_size;
+		session->state = sb_state_writing;
+	}
+
+	cants_write_block_stream_handler(session->address + (uint16_t)first * 8,
+			&session->buffer[(uint16_t)first * 8], size,
+			session->state == sb_state_writing, &session->done);
+}
+#endif
+
+/**
+ * @brief Process Set Block message
+ * @param [in] msg pooled CAN-TS message, freed when processed
+ * @retval None
+ */
+static void block_sb_process(struct cants_msg *msg)
+{
+	struct sb_session *session;
+	uint8_t seq, nack, ra, cont;
+	ADDRESS_TYPE address;
+
+	ra = cants_msg_cmd(msg) >> BLOCK_RA_SHIFT;
+	cont = ra == BLOCK_RA_REQUEST && (cants_msg_cmd(msg) & BLOCK_REQUEST_CONTINUE);
+
+	/* find session state coresponding to message source id */
+	session = block_get_sb_session(msg);
+
+	/*
+	 *  Session must always be found, unless it's a new session
+	 *  request frame, in which case it must not be found.
+	 */
+	if ((session && ra == BLOCK_RA_REQUEST && !cont) ||
+		(!session && (ra != BLOCK_RA_REQUEST || cont))) {
+		block_send_ack(msg, 0, 1);
+		cants_msg_free(msg);
+		return;
+	}
+
+	nack = 1;
+
+	switch (ra) {
+	/* process request message */
+	case BLOCK_RA_REQUEST:
+		seq = cants_msg_cmd(msg) & BLOCK_SEQ_MASK;
+		if (cont) {
+			/* next window follows previous one, which must be already written */
+			nack = msg->length != 0 ||
+				   !((session->state == sb_state_writing && session->done) ||
+					 session->state == sb_state_done);
+			address = session->address + session->max_seq * 8 + session->last_blk_size;
+		} else {
+			session = block_new_sb_session();
+			nack = !session || !block_copy_address(msg, &address);
+		}
+		/* validate session request, buffer is leased only for accepted one */
+		nack = nack || seq >= SB_WINDOW_FRAMES ||
+			   !cants_validate_write_address(address, (uint16_t)(seq + 1) * 8);
+		if (!nack && !session->buffer) {
+			/* exhausted arena is reported as nack */
+			session->buffer = block_buffer_alloc();
+			nack = !session->buffer;
+		}
+		if (!nack) {
+			/* initialize session state */
+			session->address = address;
+			session->source = cants_msg_src(msg);
+			block_index_set(sb_session_index, session->source, session - sb_sessions);
+			session->max_seq = seq;
+			memset(session->mask, 0, sizeof(session->mask));
+			session->done = 0;
+#if SB_STREAMING_WRITE
+			session->streamed = 0;
+#endif
+			session->state = sb_state_receiving;
+			block_send_ack(msg, 1, 1);
+		}
+		break;
+	/* process abort message */
+	case BLOCK_RA_ABORT:
+		if (msg->length == 0) {
+			nack = 0;
+			block_sb_close(session);
+			block_send_ack(msg, 1, 1);
+		}
+		break;
+	/* process status message */
+	case BLOCK_RA_SB_STATUS:
+		if (msg->length == 0) {
+			uint16_t command = BLOCK_RA_SB_REPORT << BLOCK_RA_SHIFT;
+
+			nack = 0;
+			block_sb_finish(session);
+			if (session->state == sb_state_done)
+				command |= 1U << 6;
+			cants_msg_reply(msg);
+			cants_msg_set_cmd(msg, command);
+			msg->length = (session->max_seq + 1 + 7) / 8;
+			bitmap_to_bytes(session->mask, msg->data, msg->length);
+			cants_send_msg(msg, 1);
+		}
+		break;
+	/* process transfer message */
+	case BLOCK_RA_SB_TRANSFER:
+		if (session->state == sb_state_receiving) {
+			seq = cants_msg_cmd(msg) & BLOCK_SEQ_MASK;
+
+			/* validate sequence number and message length */
+			if ((seq < session->max_seq && msg->length == 8) ||
+				(seq == session->max_seq && msg->length > 0)) {
+				nack = 0;
+
+				/* last block may be of different length */
+				if (seq == session->max_seq)
+					session->last_blk_size = msg->length;
+
+#if SB_STREAMING_WRITE
+				/* blocks passed to stream handler must not change, repeated ones are ignored */
+				if (seq >= session->streamed) {
+					bitmap_set(session->mask, seq);
+					memcpy(&session->buffer[(uint16_t)seq * 8], msg->data, msg->length);
+					block_sb_stream(session);
+				}
+#else
+				/* mark block as received and copy it's data */
+				bitmap_set(session->mask, seq);
+				memcpy(&session->buffer[(uint16_t)seq * 8], msg->data, msg->length);
+
+				/* if all data transfer has been received, start processing the data */
+				if (bitmap_full(session->mask, session->max_seq + 1)) {
+					uint16_t size = session->max_seq * 8 + session->last_blk_size;
+					session->done = 0;
+					session->state = sb_state_writing;
+					cants_write_block_handler(session->address, session->buffer, size, &session->done);
+				}
+#endif
+			}
+		}
+		break;
+	default:
+		/* nothing to do */
+		break;
 	}
+
+	if (nack)
+		block_send_ack(msg, 0, 1);
+	else
+		/* all valid packets reset timeout, once the batch is processed */
+		session->rearm = 1;
+
+	cants_msg_free(msg);
 }
 
 /**
@@ -269,140 +552,32 @@ static void block_sb_timeout(struct sb_session *session)
  */
 static void cants_setblock_task(void *arg)
 {
-	TickType_t timeout = portMAX_DELAY;
-	struct sb_session *session;
-	uint8_t seq, i, nack, ra;
-	struct cants_msg msg;
-	int8_t tindex = -1;
+	struct cants_deadline *timer;
+	struct cants_msg *msg;
+	uint8_t batch, i;
 
 	(void)arg;
 
 	while (1) {
-		if (xQueueReceive(setblock_queue, &msg, timeout)) {
-			ra = msg.command >> BLOCK_RA_SHIFT;
-
-			/* find session state coresponding to message source id */
-			session = block_get_sb_session(&msg);
-
-			/*
-			 *  Session must always be found, unless it's a request frame,
-			 *  in which case it must not be found.
-			 */
-			if ((session && ra == BLOCK_RA_REQUEST) ||
-				(!session && ra != BLOCK_RA_REQUEST)) {
-				block_send_ack(&msg, 0, 1);
-				continue;
-			}
-
-			nack = 1;
-
-			switch (msg.command >> BLOCK_RA_SHIFT) {
-			/* process request message */
-			case BLOCK_RA_REQUEST:
-				seq = msg.command & 0x3f;
-				session = block_new_sb_session();
-				/* validate session request */
-				nack = !session ||
-					   !block_copy_address(&msg, &session->address) ||
-					   !cants_validate_write_address(session->address,
-							   (uint16_t)(seq + 1) * 8);
-				if (!nack) {
-					/* initialize session state */
-					session->source = msg.source;
-					session->max_seq = seq;
-					memset(session->mask, 0, sizeof(session->mask));
-					session->state = sb_state_receiving;
-					block_send_ack(&msg, 1, 1);
+		/* wait for message until the earliest session timeout, then take what is already queued */
+		if (xQueueReceive(setblock_queue, &msg, cants_deadlines_wait(&sb_deadlines))) {
+			batch = CANTS_QUEUE_BATCH;
+			do
+				block_sb_process(msg);
+			while (--batch && xQueueReceive(setblock_queue, &msg, 0));
+
+			/* timeout of each session is moved once per batch, not for every data frame */
+			for (i = 0; i < MAX_SB_SESSIONS; i++) {
+				if (sb_sessions[i].rearm) {
+					sb_sessions[i].rearm = 0;
+					block_sb_reset_timeout(&sb_sessions[i]);
 				}
-				break;
-			/* process abort message */
-			case BLOCK_RA_ABORT:
-				if (msg.length == 0) {
-					nack = 0;
-					session->state = sb_state_idle;
-					block_send_ack(&msg, 1, 1);
-				}
-				break;
-			/* process status message */
-			case BLOCK_RA_SB_STATUS:
-				if (msg.length == 0) {
-					nack = 0;
-					msg.destination = msg.source;
-					msg.source = CANTS_NODE_ID;
-					msg.command = BLOCK_RA_SB_REPORT << BLOCK_RA_SHIFT;
-					if ((session->state == sb_state_writing && session->done) ||
-						(session->state == sb_state_done))
-						msg.command |= 1U << 6;
-					msg.length = (session->max_seq + 1 + 7) / 8;
-					memcpy(msg.data, session->mask, msg.length);
-					cants_send_msg(&msg, 1);
-				}
-				break;
-			/* process transfer message */
-			case BLOCK_RA_SB_TRANSFER:
-				if (session->state == sb_state_receiving) {
-					seq = msg.command & 0x3f;
-
-					/* validate sequence number and message length */
-					if ((seq < session->max_seq && msg.length == 8) ||
-						(seq == session->max_seq && msg.length > 0)) {
-						nack = 0;
-
-						/* last block may be of different length */
-						if (seq == session->max_seq)
-							session->last_blk_size = msg.length;
-
-						/* mark block as received and copy it's data */
-						block_update_mask(session->mask, seq);
-						memcpy(&session->buffer[(uint16_t)seq * 8], msg.data, msg.length);
-
-						/* if all data transfer has been received, start processing the data */
-						if (block_check_fully_received(session->mask, session->max_seq + 1)) {
-							uint16_t size = session->max_seq * 8 + session->last_blk_size;
-							session->done = 0;
-							session->state = sb_state_writing;
-							cants_write_block_handler(session->address, session->buffer, size, &session->done);
-						}
-					}
-				}
-				break;
-			default:
-				/* nothing to do */
-				break;
 			}
-
-			if (nack)
-				block_send_ack(&msg, 0, 1);
-			else
-				/* all valid packets reset timeout */
-				block_sb_reset_timeout(session);
-		} else if (tindex > -1) {
-			/* process timeout */
-			cants_assert(tindex < MAX_SB_SESSIONS);
-			block_sb_timeout(&sb_sessions[tindex]);
 		}
 
-		/* search for the next timeout */
-		timeout = portMAX_DELAY;
-		tindex = -1;
-		for (i = 0; i < MAX_SB_SESSIONS; i++) {
-			session = &sb_sessions[i];
-
-			/* skip inactive sessions */
-			if (session->state == sb_state_idle)
-				continue;
-
-			/* immediately handle expired timeouts */
-			if (xTaskCheckForTimeOut(&session->timeout_state, &session->timeout) != pdFALSE)
-				block_sb_timeout(session);
-
-			/* above "if" changed either state or timeout, so state have to be checked again */
-			if (session->state != sb_state_idle && session->timeout < timeout) {
-				/* store info about next timeout */
-				timeout = session->timeout;
-				tindex = i;
-			}
-		}
+		/* handle expired timeouts, timer of idle session expires without effect */
+		while ((timer = cants_deadlines_expired(&sb_deadlines)))
+			block_sb_timeout(&sb_sessions[timer->id]);
 	}
 }
 
@@ -413,32 +588,57 @@ static void cants_setblock_task(void *arg)
  */
 static struct gb_session *block_get_gb_session(struct cants_msg *msg)
 {
-	uint8_t i;
+	uint8_t source = cants_msg_src(msg), i = block_index_get(gb_session_index, source);
+	struct gb_session *session;
 
-	for (i = 0; i < MAX_GB_SESSIONS; ++i) {
-		struct gb_session *session = &gb_sessions[i];
+	if (i >= MAX_GB_SESSIONS)
+		return NULL;
 
-		/* match session based on source ID */
-		if (session->source == msg->source &&
-			session->state != gb_state_idle)
-			return session;
-	}
+	/* match session based on source ID */
+	session = &gb_sessions[i];
+	if (session->source == source && session->state != gb_state_idle)
+		return session;
 
 	return NULL;
 }
 
+/**
+ * @brief Return buffers of idle Get Block session to arena, except ones still being read
+ * @param [in] session session state
+ * @retval None
+ */
+static void block_gb_reclaim(struct gb_session *session)
+{
+	uint8_t i;
+
+	if (session->state != gb_state_idle)
+		return;
+
+	for (i = 0; i < GB_BUFFERS; i++) {
+		if (session->buffer[i] && session->done[i]) {
+			block_buffer_free(session->buffer[i]);
+			session->buffer[i] = NULL;
+		}
+	}
+}
+
 /**
  * @brief Find free slot for new Get Block session
  * @retval pointer to a new session state if available, NULL otherwise
  */
 static struct gb_session *block_new_gb_session(void)
 {
-	uint8_t i;
+	uint8_t i, j, busy;
 
 	for (i = 0; i < MAX_GB_SESSIONS; ++i) {
 		struct gb_session *session = &gb_sessions[i];
 
-		if (session->state == gb_state_idle)
+		/* buffers of aborted session may be still in use by read handler */
+		block_gb_reclaim(session);
+		for (busy = 0, j = 0; j < GB_BUFFERS; j++)
+			busy |= !session->done[j];
+
+		if (session->state == gb_state_idle && !busy)
 			return session;
 	}
 
@@ -452,9 +652,17 @@ static struct gb_session *block_new_gb_session(void)
  */
 static void block_gb_reset_timeout(struct gb_session *session)
 {
-	vTaskSetTimeOutState(&session->timeout_state);
-	session->timeout = (session->state == gb_state_transmitting) ?
-		pdMS_TO_TICKS(GB_BURST_INTERVAL) : pdMS_TO_TICKS(GB_TIMEOUT);
+	TickType_t ticks;
+
+	if (session->state == gb_state_transmitting)
+		ticks = pdMS_TO_TICKS(GB_BURST_INTERVAL);
+	/* when reading data, value of "done" field has to be checked more often */
+	else if (session->state == gb_state_reading)
+		ticks = pdMS_TO_TICKS(GB_READING_INTERVAL);
+	else
+		ticks = pdMS_TO_TICKS(GB_TIMEOUT);
+
+	cants_deadline_arm(&gb_deadlines, &session->timer, ticks);
 }
 
 /**
@@ -465,31 +673,98 @@ static void block_gb_reset_timeout(struct gb_session *session)
 static void block_gb_burst(struct gb_session *session)
 {
 	struct cants_msg msg;
-	uint8_t cnt = 0;
+	uint8_t cnt = 0, limit;
 
 	/* prepare static fields for messages */
-	msg.destination = session->source;
-	msg.source = CANTS_NODE_ID;
+	cants_msg_set_id(&msg, session->source, cants_type_get_block, CANTS_NODE_ID, 0);
 	msg.length = 8;
-	msg.type = cants_type_get_block;
-
-	/* Send burst of data frames. It will send GB_BURST_SIZE packets at most. */
-	while (session->cur_seq <= session->max_seq && cnt < GB_BURST_SIZE) {
-		if (block_check_seq_in_mask(session->mask, session->cur_seq)) {
-			/* set sequence number and copy data */
-			msg.command = (BLOCK_RA_GB_TRANSFER << BLOCK_RA_SHIFT) | session->cur_seq;
-			memcpy(msg.data, &session->buffer[(uint16_t)(session->cur_seq) * 8], 8);
-			if (!cants_send_msg(&msg, 0))
-				return;
-			cnt++;
-		}
-		session->cur_seq++;
+
+	/*
+	 * Send burst of data frames. Burst is limited by free space in CAN
+	 * transmission queue, less entries reserved for other replies, and by
+	 * GB_BURST_SIZE. Whole burst is queued in one critical section, nested
+	 * ones in cants_send_msg() don't touch interrupt state.
+	 */
+	taskENTER_CRITICAL();
+	limit = cants_send_free();
+	limit = limit > GB_TX_RESERVE ? limit - GB_TX_RESERVE : 0;
+	if (limit > GB_BURST_SIZE)
+		limit = GB_BURST_SIZE;
+
+	/* cur_seq is always on requested frame, or past the window */
+	while (session->cur_seq <= session->max_seq && cnt < limit) {
+		/* set sequence number and copy data */
+		cants_msg_set_cmd(&msg, (BLOCK_RA_GB_TRANSFER << BLOCK_RA_SHIFT) | session->cur_seq);
+		memcpy(msg.data, &session->buffer[session->cur][(uint16_t)(session->cur_seq) * 8], 8);
+		/* frame which wasn't sent is retried in next burst */
+		if (!cants_send_msg(&msg, 0))
+			break;
+		cnt++;
+		session->cur_seq = bitmap_next_set(session->mask, session->cur_seq + 1, session->max_seq + 1);
 	}
 
+	/* let TX interrupt resume transmission once queue drains */
+	if (session->cur_seq <= session->max_seq)
+		gb_tx_wait = 1;
+	taskEXIT_CRITICAL();
+
 	if (session->cur_seq > session->max_seq)
 		session->state = gb_state_wait_on_start;
 }
 
+#if GB_READ_AHEAD
+/**
+ * @brief Start reading window following current one into other buffer, so
+ * continue request can be served without waiting on read. Window of the same
+ * size as current one is read.
+ * @param [in] session session state
+ * @retval None
+ */
+static void block_gb_read_ahead(struct gb_session *session)
+{
+	uint8_t next = session->cur ^ 1;
+	uint16_t size = (uint16_t)(session->max_seq + 1) * 8;
+
+	/* other buffer may be still in use by discarded read-ahead */
+	if (session->ahead_frames || !session->done[next])
+		return;
+
+	/* read-ahead is skipped if arena is exhausted */
+	if (!session->buffer[next] && !(session->buffer[next] = block_buffer_alloc()))
+		return;
+
+	/* reading beyond the end of memory fails, there is nothing to read ahead then */
+	session->done[next] = 0;
+	if (cants_read_block_handler(session->address + size, session->buffer[next], size, &session->done[next]))
+		session->ahead_frames = session->max_seq + 1;
+	else
+		session->done[next] = 1;
+}
+#endif
+
+/**
+ * @brief Leave reading state if data has been read, start transmission if
+ * start packet has already been received
+ * @param [in] session session state
+ * @retval None
+ */
+static void block_gb_check_read(struct gb_session *session)
+{
+	if (session->state != gb_state_reading || !session->done[session->cur])
+		return;
+
+	if (session->started) {
+		session->state = gb_state_transmitting;
+		block_gb_burst(session);
+	} else {
+		session->state = gb_state_wait_on_start;
+	}
+
+#if GB_READ_AHEAD
+	block_gb_read_ahead(session);
+#endif
+}
+
 /**
  * @brief Handle Get Block timeouts
  * @param [in] session session state
@@ -500,11 +775,135 @@ static void block_gb_timeout(struct gb_session *session)
 	if (session->state == gb_state_transmitting) {
 		block_gb_burst(session);
 		block_gb_reset_timeout(session);
+	} else if (session->state == gb_state_reading) {
+		block_gb_check_read(session);
+		block_gb_reset_timeout(session);
 	} else {
 		session->state = gb_state_idle;
+		block_gb_reclaim(session);
 	}
 }
 
+/**
+ * @brief Process Get Block message
+ * @param [in] msg pooled CAN-TS message, freed when processed
+ * @retval None
+ */
+static void block_gb_process(struct cants_msg *msg)
+{
+	struct gb_session *session;
+	uint8_t seq, nack, ra, cont;
+	ADDRESS_TYPE address;
+
+	ra = cants_msg_cmd(msg) >> BLOCK_RA_SHIFT;
+	cont = ra == BLOCK_RA_REQUEST && (cants_msg_cmd(msg) & BLOCK_REQUEST_CONTINUE);
+
+	/* find session state coresponding to message source id */
+	session = block_get_gb_session(msg);
+
+	/*
+	 *  Session must always be found, unless it's a new session
+	 *  request frame, in which case it must not be found.
+	 */
+	if ((session && ra == BLOCK_RA_REQUEST && !cont) ||
+		(!session && (ra != BLOCK_RA_REQUEST || cont))) {
+		block_send_ack(msg, 0, 1);
+		cants_msg_free(msg);
+		return;
+	}
+
+	nack = 1;
+
+	switch (ra) {
+	/* process request */
+	case BLOCK_RA_REQUEST:
+		seq = cants_msg_cmd(msg) & BLOCK_SEQ_MASK;
+		if (cont) {
+			/* next window follows previous one, which must not be in transmission */
+			nack = msg->length != 0 || session->state != gb_state_wait_on_start;
+			address = session->address + (uint16_t)(session->max_seq + 1) * 8;
+		} else {
+			session = block_new_gb_session();
+			nack = !session || !block_copy_address(msg, &address);
+		}
+		/* validate session request and start reading, it may finish later */
+		nack = nack || seq >= GB_WINDOW_FRAMES;
+#if GB_READ_AHEAD
+		/* use read-ahead buffer if it holds requested window, its read may be still pending */
+		if (!nack && cont && session->ahead_frames > seq) {
+			session->cur ^= 1;
+		} else
+#endif
+		if (!nack) {
+			/* exhausted arena is reported as nack */
+			if (!session->buffer[session->cur]) {
+				session->buffer[session->cur] = block_buffer_alloc();
+				nack = !session->buffer[session->cur];
+			}
+			if (!nack) {
+				uint8_t *done = &session->done[session->cur];
+
+				*done = 0;
+				nack = !cants_read_block_handler(address, session->buffer[session->cur],
+						(uint16_t)(seq + 1) * 8, done);
+				/* read hasn't started, so buffer is free */
+				if (nack)
+					*done = 1;
+			}
+		}
+		if (!nack) {
+			/* initialize session state */
+			session->address = address;
+			session->source = cants_msg_src(msg);
+			block_index_set(gb_session_index, session->source, session - gb_sessions);
+			session->max_seq = seq;
+			session->started = 0;
+#if GB_READ_AHEAD
+			session->ahead_frames = 0;
+#endif
+			session->state = gb_state_reading;
+			block_send_ack(msg, 1, 1);
+			block_gb_check_read(session);
+		}
+		break;
+	/* process abort message */
+	case BLOCK_RA_ABORT:
+		if (msg->length == 0) {
+			nack = 0;
+			session->state = gb_state_idle;
+			block_gb_reclaim(session);
+			block_send_ack(msg, 1, 1);
+		}
+		break;
+	/* process start message */
+	case BLOCK_RA_GB_START:
+		if (block_validate_mask(session->mask, msg->data, msg->length, session->max_seq + 1)) {
+			nack = 0;
+			session->cur_seq = bitmap_next_set(session->mask, 0, session->max_seq + 1);
+			/* if data is not read yet, transmission starts when it is */
+			if (session->state == gb_state_reading) {
+				session->started = 1;
+				block_gb_check_read(session);
+			} else {
+				session->state = gb_state_transmitting;
+				block_gb_burst(session);
+			}
+		}
+		break;
+	default:
+		/* nothing to do */
+		break;
+	}
+
+	if (nack)
+		block_send_ack(msg, 0, 1);
+	else
+		/* all valid packets reset timeout */
+		block_gb_reset_timeout(session);
+
+	cants_msg_free(msg);
+}
+
 /**
  * @brief Get Block handling task
  * @param [in] arg ignored
@@ -512,118 +911,67 @@ static void block_gb_timeout(struct gb_session *session)
  */
 static void cants_getblock(void *arg)
 {
-	TickType_t timeout = portMAX_DELAY;
+	struct cants_deadline *timer;
 	struct gb_session *session;
-	uint8_t seq, nack, i, ra;
-	ADDRESS_TYPE address;
-	struct cants_msg msg;
-	int8_t tindex = -1;
+	struct cants_msg *msg;
+	uint8_t batch, i;
 
 	(void)arg;
 
 	while (1) {
-		if (xQueueReceive(getblock_queue, &msg, timeout)) {
-			ra = msg.command >> BLOCK_RA_SHIFT;
-
-			/* find session state coresponding to message source id */
-			session = block_get_gb_session(&msg);
-
-			/*
-			 *  Session must always be found, unless it's a request frame,
-			 *  in which case it must not be found.
-			 */
-			if ((session && ra == BLOCK_RA_REQUEST) ||
-				(!session && ra != BLOCK_RA_REQUEST)) {
-				block_send_ack(&msg, 0, 1);
-				continue;
-			}
+		/* wait for message until the earliest session timeout, then take what is already queued */
+		if (xQueueReceive(getblock_queue, &msg, cants_deadlines_wait(&gb_deadlines))) {
+			batch = CANTS_QUEUE_BATCH;
+			do
+				/* NULL message only wakes task up, see block_tx_done_isr() */
+				if (msg)
+					block_gb_process(msg);
+			while (--batch && xQueueReceive(getblock_queue, &msg, 0));
+		}
 
-			nack = 1;
-
-			switch (ra) {
-			/* process request */
-			case BLOCK_RA_REQUEST:
-				seq = msg.command & 0x3f;
-				session = block_new_gb_session();
-				/* validate session request */
-				nack = !session ||
-					   !block_copy_address(&msg, &address) ||
-					   /* TODO: make async */
-					   !cants_read_block_handler(address, session->buffer,
-							   (uint16_t)(seq + 1) * 8);
-				if (!nack) {
-					/* initialize session state */
-					session->source = msg.source;
-					session->max_seq = seq;
-					session->state = gb_state_wait_on_start;
-					block_send_ack(&msg, 1, 1);
-				}
-				break;
-			/* process abort message */
-			case BLOCK_RA_ABORT:
-				if (msg.length == 0) {
-					nack = 0;
-					session->state = gb_state_idle;
-					block_send_ack(&msg, 1, 1);
-				}
-				break;
-			/* process start message */
-			case BLOCK_RA_GB_START:
-				if (block_validate_mask(msg.data, msg.length, session->max_seq + 1)) {
-					nack = 0;
-					memcpy(&session->mask, msg.data, msg.length);
-					session->cur_seq = 0;
-					session->state = gb_state_transmitting;
+		/* CAN transmission queue has drained, continue with bursts */
+		if (gb_tx_ready) {
+			gb_tx_ready = 0;
+			for (i = 0; i < MAX_GB_SESSIONS; i++) {
+				session = &gb_sessions[i];
+				if (session->state == gb_state_transmitting) {
 					block_gb_burst(session);
+					block_gb_reset_timeout(session);
 				}
-				break;
-			default:
-				/* nothing to do */
-				break;
 			}
-
-			if (nack)
-				block_send_ack(&msg, 0, 1);
-			else
-				/* all valid packets reset timeout */
-				block_gb_reset_timeout(session);
-		} else if (tindex > -1) {
-			/* process timeout */
-			cants_assert(tindex < MAX_GB_SESSIONS);
-			block_gb_timeout(&gb_sessions[tindex]);
-			tindex = -1;
 		}
 
-		/* search for the next timeout */
-		timeout = portMAX_DELAY;
-		tindex = -1;
-		for (i = 0; i < MAX_GB_SESSIONS; i++) {
-			session = &gb_sessions[i];
-
-			/* skip inactive sessions */
-			if (session->state == gb_state_idle)
-				continue;
-
-			/* immediately handle expired timeouts */
-			if (xTaskCheckForTimeOut(&session->timeout_state, &session->timeout) != pdFALSE)
-				block_gb_timeout(session);
-
-			/* above "if" changed either state or timeout, so state have to be checked again */
-			if (session->state != gb_state_idle && session->timeout < timeout) {
-				/* store info about next timeout */
-				timeout = session->timeout;
-				tindex = i;
-			}
-		}
+		/* handle expired timeouts, timer of idle session expires without effect */
+		while ((timer = cants_deadlines_expired(&gb_deadlines)))
+			block_gb_timeout(&gb_sessions[timer->id]);
 	}
 }
 
 void block_init(void)
 {
+	uint8_t i, j;
+
+	/* all arena buffers are free */
+	for (i = 0; i < BLOCK_ARENA_BUFFERS; i++)
+		block_arena_free[i] = block_arena[i];
+	block_arena_free_count = BLOCK_ARENA_BUFFERS;
+
+	/* no timeout is armed and no read is in progress */
+	cants_deadlines_init(&sb_deadlines, sb_deadline_heap, MAX_SB_SESSIONS);
+	for (i = 0; i < MAX_SB_SESSIONS; i++)
+		cants_deadline_init(&sb_sessions[i].timer, i);
+
+	cants_deadlines_init(&gb_deadlines, gb_deadline_heap, MAX_GB_SESSIONS);
+	for (i = 0; i < MAX_GB_SESSIONS; i++) {
+		cants_deadline_init(&gb_sessions[i].timer, i);
+		for (j = 0; j < GB_BUFFERS; j++)
+			gb_sessions[i].done[j] = 1;
+	}
+
 	/* initialize Set and Get Block queues */
-	setblock_queue = xQueueCreateStatic(SETBLOCK_QUEUE_LEN, sizeof(struct cants_msg),
+	setblock_queue = xQueueCreateStatic(SETBLOCK_QUEUE_LEN, sizeof(struct cants_msg *),
 			setblock_queue_buffer, &setblock_queue_struct);
-	getblock_queue = xQueueCreateStatic(GETBLOCK_QUEUE_LEN, sizeof(struct cants_msg),
+	getblock_queue = xQueueCreateStatic(GETBLOCK_QUEUE_LEN, sizeof(struct cants_msg *),
 			getblock_queue_buffer, &getblock_queue_struct);
 
 	/* initialize Set and Get Block tasks */
@@ -633,30 +981,59 @@ void block_init(void)
 			0, SETBLOCK_PRIORITY, setblock_task_stack, &setblock_task_buffer);
 }
 
+uint8_t block_tx_done_isr(uint8_t free)
+{
+	static struct cants_msg *const wake = NULL;
+	BaseType_t yield = pdFALSE;
+
+	if (!gb_tx_wait || free < GB_TX_RESERVE + GB_TX_RESUME)
+		return 0;
+
+	gb_tx_wait = 0;
+	gb_tx_ready = 1;
+
+	/* task checks the flag after every message, so it only has to be woken up if queue is empty */
+	if (!uxQueueMessagesWaitingFromISR(getblock_queue))
+		xQueueSendToBackFromISR(getblock_queue, &wake, &yield);
+
+	return yield == pdTRUE;
+}
+
 uint8_t block_process(struct cants_msg *msg)
 {
-	/* dispatch message to appropriate task */
-	if (msg->type == cants_type_set_block)
-		return xQueueSendToBack(setblock_queue, msg, pdMS_TO_TICKS(10)) != errQUEUE_FULL;
+	/* dispatch message to appropriate task, dispatcher nacks it if queue is full */
+	uint8_t type = cants_msg_type(msg);
+
+	if (type == cants_type_set_block)
+		return xQueueSendToBack(setblock_queue, &msg, 0) != errQUEUE_FULL;
 
-	if (msg->type == cants_type_get_block)
-		return xQueueSendToBack(getblock_queue, msg, pdMS_TO_TICKS(10)) != errQUEUE_FULL;
+	if (type == cants_type_get_block)
+		return xQueueSendToBack(getblock_queue, &msg, 0) != errQUEUE_FULL;
 
 	return 0;
 }
 
+uint8_t block_process_isr(struct cants_msg *msg, BaseType_t *yield)
+{
+	QueueHandle_t queue = cants_msg_type(msg) == cants_type_set_block ? setblock_queue : getblock_queue;
+
+	/* full queue is left to dispatcher, which nacks */
+	if (xQueueIsQueueFullFromISR(queue))
+		return 0;
+
+	return xQueueSendToBackFromISR(queue, &msg, yield) == pdTRUE;
+}
+
 void block_send_ack(struct cants_msg *msg, uint8_t ack, uint8_t wait_allowed)
 {
 	/* set source and destination address */
-	msg->destination = msg->source;
-	msg->source = CANTS_NODE_ID;
+	cants_msg_reply(msg);
 
 	/* set ack or nack flag */
 	if (ack) {
-		msg->command &= ~(7 << BLOCK_RA_SHIFT);
-		msg->command |= BLOCK_RA_ACK << BLOCK_RA_SHIFT;
+		cants_msg_set_cmd(msg, (cants_msg_cmd(msg) & ~(7 << BLOCK_RA_SHIFT)) | (BLOCK_RA_ACK << BLOCK_RA_SHIFT));
 	} else {
-		msg->command = BLOCK_RA_NACK << BLOCK_RA_SHIFT;
+		cants_msg_set_cmd(msg, BLOCK_RA_NACK << BLOCK_RA_SHIFT);
 		/* nack frame hasn't any data */
 		msg->length = 0;
 	}
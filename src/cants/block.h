@@ -12,6 +12,7 @@
 #define BLOCK_H_
 
 #include "cants.h"
+#include "FreeRTOS.h"
 
 /**
  * @name Block tranfer Request/Acknowledge definitions
@@ -22,6 +23,22 @@
 #define BLOCK_RA_ACK      2U /**< RA acknowledge */
 #define BLOCK_RA_ABORT    3U /**< RA abort  */
 #define BLOCK_RA_NACK     4U /**< RA nack */
+#define BLOCK_SEQ_MASK    0x3fU /**< sequence number (or maximum sequence number in request) mask */
+#define BLOCK_MAX_FRAMES  64U /**< maximum number of frames in one window, limited by sequence number size */
+/**
+ *@}
+ */
+
+/**
+ * @name Block transfer request flags
+ *@{
+ */
+/**
+ * Continue request, sent without address after previous window has been
+ * written/read. Session moves to address right after previous window, so
+ * large transfers don't have to open new session for each window.
+ */
+#define BLOCK_REQUEST_CONTINUE (1U << 6)
 /**
  *@}
  */
@@ -54,12 +71,20 @@
 void block_init(void);
 
 /**
- * @brief Process block transfer message
- * @param [in] msg Block transfer message to process
+ * @brief Process block transfer message. Doesn't wait for space in full queue.
+ * @param [in] msg pooled Block transfer message to process, owned by block transfer task if accepted
  * @retval Non-zero if message is accepted for processing, 0 otherwise
  */
 uint8_t block_process(struct cants_msg *msg);
 
+/**
+ * @brief Put block transfer message directly into Set or Get Block queue from ISR
+ * @param [in] msg pooled Block transfer message, owned by block transfer task if accepted
+ * @param [out] yield set to pdTRUE if context switch is required
+ * @retval Non-zero if message is accepted, 0 if queue is full
+ */
+uint8_t block_process_isr(struct cants_msg *msg, BaseType_t *yield);
+
 /**
  * @brief Modify message into block transfer ack/nack
  * @param [in] msg Block transfer message
@@ -69,6 +94,19 @@ uint8_t block_process(struct cants_msg *msg);
  */
 void block_send_ack(struct cants_msg *msg, uint8_t ack, uint8_t wait_allowed);
 
+/**
+ * @brief Resume Get Block transmission, which was stopped by full CAN transmission queue
+ * @param [in] free number of free entries in CAN transmission queue
+ * @retval 1 if context switch is required, 0 otherwise
+ */
+uint8_t block_tx_done_isr(uint8_t free);
+
+/**
+ * @brief Get number of free buffers in block transfer arena
+ * @retval number of free buffers
+ */
+uint8_t block_arena_free_buffers(void);
+
 #endif
 
 /**
@@ -12,36 +12,262 @@
 #include "block.h"
 #include "cants.h"
 #include "FreeRTOS.h"
-#include "queue.h"
 #include "task.h"
 #include "tctm.h"
 
-/* dispatcher queue related variables */
-static QueueHandle_t dispatcher_queue = NULL;
-static StaticQueue_t dispatcher_queue_struct;
-static uint8_t dispatcher_queue_buffer[DISPATCHER_QUEUE_LEN * sizeof(struct cants_msg)];
+#if DISPATCHER_QUEUE_LEN > 128 || DISPATCHER_QUEUE_LEN & (DISPATCHER_QUEUE_LEN - 1)
+#error "DISPATCHER_QUEUE_LEN must be power of two, not bigger than 128"
+#endif
+
+#if DISPATCHER_NACK_LEN > 128 || DISPATCHER_NACK_LEN & (DISPATCHER_NACK_LEN - 1)
+#error "DISPATCHER_NACK_LEN must be power of two, not bigger than 128"
+#endif
+
+#if DISPATCHER_TC_QUOTA + DISPATCHER_TM_QUOTA + DISPATCHER_SB_QUOTA + DISPATCHER_GB_QUOTA >= DISPATCHER_QUEUE_LEN
+#error "dispatcher quotas must leave part of dispatcher ring to time sync and unsolicited TM"
+#endif
+
+/* time sync and unsolicited TM share one count and the rest of dispatcher ring */
+#define DISPATCHER_SHARED_QUOTA (DISPATCHER_QUEUE_LEN - DISPATCHER_TC_QUOTA - DISPATCHER_TM_QUOTA - \
+		DISPATCHER_SB_QUOTA - DISPATCHER_GB_QUOTA)
+
+#if DISPATCHER_TC_QUOTA + DISPATCHER_TM_QUOTA + DISPATCHER_SB_QUOTA + DISPATCHER_GB_QUOTA + \
+		DISPATCHER_SHARED_QUOTA > DISPATCHER_QUEUE_LEN
+#error "sum of dispatcher quotas must not be bigger than DISPATCHER_QUEUE_LEN"
+#endif
+
+/*
+ * Dispatcher ring. CAN ISR is the only producer and writes only head,
+ * dispatcher task is the only consumer and writes only tail, so neither
+ * side needs critical section. Indices run freely and wrap at 256, their
+ * difference is number of queued messages.
+ */
+static struct cants_msg *volatile dispatcher_queue_buffer[DISPATCHER_QUEUE_LEN];
+static volatile uint8_t dispatcher_head;
+static volatile uint8_t dispatcher_tail;
+
+/*
+ * Per transfer type admission to dispatcher ring. Type, which used up its
+ * quota, e.g. flood of TM requests with TM queue full, can't take entries
+ * other types rely on. Count is incremented by ISR and decremented by
+ * dispatcher in critical section. Unsolicited TM is counted and limited
+ * together with time sync, see cants_dispatcher_share().
+ */
+static const uint8_t dispatcher_quota[cants_types] = {
+	[cants_type_time_sync] = DISPATCHER_SHARED_QUOTA,
+	[cants_type_telecommand] = DISPATCHER_TC_QUOTA,
+	[cants_type_telemetry] = DISPATCHER_TM_QUOTA,
+	[cants_type_set_block] = DISPATCHER_SB_QUOTA,
+	[cants_type_get_block] = DISPATCHER_GB_QUOTA,
+};
+static volatile uint8_t dispatcher_pending[cants_types];
+
+/*
+ * Requests over their type's quota wait here only to be nacked, so sender
+ * learns at once that node is busy. Same producer and consumer scheme as
+ * dispatcher ring, frames, which don't fit, are dropped without reply.
+ */
+static struct cants_msg *volatile dispatcher_nack_queue_buffer[DISPATCHER_NACK_LEN];
+static volatile uint8_t dispatcher_nack_head;
+static volatile uint8_t dispatcher_nack_tail;
 
 /* dispatcher task related variables */
 static StaticTask_t dispatcher_task_buffer;
 static StackType_t dispatcher_task_stack[DISPATCHER_STACK_SIZE];
+static TaskHandle_t dispatcher_task;
+
+/* stack statistics, updated from ISR and by dispatcher in critical section */
+static struct cants_stats stats;
+
+/*
+ * Free pool messages, which must remain after received frame of given class
+ * is accepted. Replies are copied to CAN transmission queue and need none,
+ * so the reserve is left to time sync and keep-alive. SB data frames, which
+ * are sent again if lost, give way to commands well before that.
+ */
+static const uint8_t rx_shed_free[cants_rx_classes] = {
+	[cants_rx_bulk] = CANTS_MSG_POOL_TX_RESERVE + CANTS_SHED_BULK,
+	[cants_rx_control] = CANTS_MSG_POOL_TX_RESERVE,
+	[cants_rx_essential] = 0,
+};
+
+/**
+ * @brief Get load shedding class of received frame
+ * @param [in] msg received CAN-TS message
+ * @retval one of ::cants_rx_class
+ */
+static uint8_t cants_rx_class(const struct cants_msg *msg)
+{
+	switch (cants_msg_type(msg)) {
+	case cants_type_time_sync:
+	case cants_type_unsolicited_tm:
+		return cants_rx_essential;
+	case cants_type_set_block:
+		if ((cants_msg_cmd(msg) >> BLOCK_RA_SHIFT) == BLOCK_RA_SB_TRANSFER)
+			return cants_rx_bulk;
+		break;
+	}
+
+	return cants_rx_control;
+}
+
+#if CANTS_ISR_ROUTING
+/**
+ * ISR routing table, indexed by transfer type. Types without entry, frames
+ * which are not accepted by their route and frames which would overtake
+ * those, go through dispatcher task.
+ */
+static uint8_t (*const isr_routes[])(struct cants_msg *msg, BaseType_t *yield) = {
+	[cants_type_telecommand] = tctm_process_isr,
+	[cants_type_telemetry] = tctm_process_isr,
+	[cants_type_set_block] = block_process_isr,
+	[cants_type_get_block] = block_process_isr,
+};
+
+/* number of frames of routed types passed to dispatcher, while non-zero all go that way to keep order */
+static volatile uint8_t dispatcher_routed_pending;
+
+/**
+ * @brief Check if transfer type has ISR route
+ * @param [in] type transfer type
+ * @retval 1 if type is routed from ISR, 0 otherwise
+ */
+static uint8_t cants_isr_routed(uint8_t type)
+{
+	return type < ARRAY_SIZE(isr_routes) && isr_routes[type];
+}
+#endif
+
+/**
+ * @brief Get dispatcher ring share of transfer type
+ * @param [in] type defined transfer type
+ * @retval index to dispatcher_quota and dispatcher_pending
+ */
+static uint8_t cants_dispatcher_share(uint8_t type)
+{
+	return type == cants_type_unsolicited_tm ? cants_type_time_sync : type;
+}
+
+/**
+ * @brief Check if dispatcher has nothing to do, so it may wait for notification
+ * @retval 1 if dispatcher ring and nack ring are empty, 0 otherwise
+ */
+static uint8_t cants_dispatcher_idle(void)
+{
+	return dispatcher_head == dispatcher_tail && dispatcher_nack_head == dispatcher_nack_tail;
+}
 
 uint8_t cants_dispatch_isr(struct cants_msg *msg)
 {
 	BaseType_t yield = pdFALSE;
+	uint8_t class, share, type = cants_msg_type(msg);
+
+	/* nobody handles undefined transfer types */
+	if (type >= cants_types) {
+		cants_msg_free_isr(msg);
+		return 0;
+	}
 
 #if !CAN_HW_FILTERING
 	/* validate destination IDs */
-	if (msg->destination != CANTS_NODE_ID &&
-		(msg->destination != CANTS_TIME_ID || msg->type != cants_type_time_sync) &&
-		(msg->destination != CANTS_KEEPALIVE_ID || msg->type != cants_type_unsolicited_tm))
+	uint8_t destination = cants_msg_dst(msg);
+
+	if (destination != CANTS_NODE_ID &&
+		(destination != CANTS_TIME_ID || type != cants_type_time_sync) &&
+		(destination != CANTS_KEEPALIVE_ID || type != cants_type_unsolicited_tm)) {
+		cants_msg_free_isr(msg);
 		return 0;
+	}
+#endif
+
+	/* message is already taken, so pool runs low when free ones are below reserve */
+	class = cants_rx_class(msg);
+	if (cants_msg_pool_free() < rx_shed_free[class]) {
+		stats.rx_shed[class]++;
+		cants_msg_free_isr(msg);
+		return 0;
+	}
+
+#if CANTS_ISR_NOTIFY
+	/* keep-alive and time sync don't wait behind queued data frames */
+	if (cants_msg_type(msg) == cants_type_time_sync && cants_msg_dst(msg) == CANTS_TIME_ID) {
+		yield = cants_time_sync_isr(msg->length, msg->data, cants_msg_time(msg));
+		cants_msg_free_isr(msg);
+		return !!yield;
+	}
+
+	if (cants_msg_type(msg) == cants_type_unsolicited_tm && cants_msg_dst(msg) == CANTS_KEEPALIVE_ID) {
+		yield = cants_keepalive_isr(cants_msg_src(msg), cants_msg_time(msg));
+		cants_msg_free_isr(msg);
+		return !!yield;
+	}
+#endif
+
+#if CANTS_ISR_ROUTING
+	if (cants_isr_routed(type) && !dispatcher_routed_pending) {
+		/* receiving task cannot run before ISR returns, so message is still valid for trace */
+		if (isr_routes[type](msg, &yield)) {
+			cants_trace(cants_trace_dispatch, msg);
+			return !!yield;
+		}
+	}
+#endif
+
+	/* request over its type's quota is only nacked, time sync and unsolicited TM have no reply */
+	share = cants_dispatcher_share(type);
+	if (dispatcher_pending[share] >= dispatcher_quota[share]) {
+		if (type == cants_type_time_sync || type == cants_type_unsolicited_tm ||
+			(uint8_t)(dispatcher_nack_head - dispatcher_nack_tail) >= DISPATCHER_NACK_LEN) {
+			stats.rx_dropped[type]++;
+			cants_msg_free_isr(msg);
+			return !!yield;
+		}
+
+		if (cants_dispatcher_idle())
+			vTaskNotifyGiveFromISR(dispatcher_task, &yield);
+
+		dispatcher_nack_queue_buffer[dispatcher_nack_head % DISPATCHER_NACK_LEN] = msg;
+		dispatcher_nack_head++;
+
+		return !!yield;
+	}
+
+	/* only pointer is queued, message stays in pool */
+	if ((uint8_t)(dispatcher_head - dispatcher_tail) >= DISPATCHER_QUEUE_LEN) {
+		stats.rx_overflow++;
+		cants_msg_free_isr(msg);
+		return !!yield;
+	}
+
+#if CANTS_ISR_ROUTING
+	if (cants_isr_routed(type))
+		dispatcher_routed_pending++;
 #endif
+	dispatcher_pending[share]++;
+
+	/* dispatcher drains both rings before it waits, so it is woken only by frame, which finds them empty */
+	if (cants_dispatcher_idle())
+		vTaskNotifyGiveFromISR(dispatcher_task, &yield);
 
-	xQueueSendToBackFromISR(dispatcher_queue, msg, &yield);
+	/* pointer must be in place before head makes it visible */
+	dispatcher_queue_buffer[dispatcher_head % DISPATCHER_QUEUE_LEN] = msg;
+	dispatcher_head++;
 
 	return !!yield;
 }
 
+void cants_get_stats(struct cants_stats *out)
+{
+	taskENTER_CRITICAL();
+	*out = stats;
+	taskEXIT_CRITICAL();
+}
+
+uint8_t cants_tx_done_isr(uint8_t free)
+{
+	return block_tx_done_isr(free);
+}
+
 /**
  * @brief Dispatcher task. Dispatches messages to appropriate handlers.
  * @param [in] arg ignored
@@ -49,60 +275,91 @@ uint8_t cants_dispatch_isr(struct cants_msg *msg)
  */
 static void cants_dispatcher(void *arg)
 {
-	uint8_t tctm_nack, block_nack;
-	struct cants_msg msg;
+	uint8_t tctm_nack, block_nack, passed, type, nack_only;
+	struct cants_msg *msg;
 
 	(void)arg;
 
 	while (1) {
-		if (xQueueReceive(dispatcher_queue, &msg, portMAX_DELAY)) {
-			tctm_nack = 0;
-			block_nack = 0;
-
-			/*
-			 * Dispatch messages to appropriate handlers. Only UTM and TS
-			 * messages are handled directly in this task.
-			 */
-			switch (msg.type) {
-			case cants_type_time_sync:
-				cants_time_sync_handler(msg.length, msg.data);
-				break;
-			case cants_type_unsolicited_tm:
-				cants_unsolicited_handler(msg.source, msg.command, msg.length, msg.data);
-				break;
-			case cants_type_telecommand:
-			case cants_type_telemetry:
-				tctm_nack = !tctm_process(&msg);
-				break;
-			case cants_type_set_block:
-			case cants_type_get_block:
-				block_nack = !block_process(&msg);
-				break;
-			}
-
-			/* if appropriate queue is full, send nack directly */
-			if (tctm_nack)
-				tctm_send_ack(&msg, 0);
-
-			if (block_nack)
-				block_send_ack(&msg, 0, 1);
+		/* wake-up may also be left over from frame already taken */
+		while (cants_dispatcher_idle())
+			ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+		/* nacks are cheap, so they go first, slot is released as soon as pointer is read */
+		nack_only = dispatcher_nack_head != dispatcher_nack_tail;
+		if (nack_only) {
+			msg = dispatcher_nack_queue_buffer[dispatcher_nack_tail % DISPATCHER_NACK_LEN];
+			dispatcher_nack_tail++;
+		} else {
+			msg = dispatcher_queue_buffer[dispatcher_tail % DISPATCHER_QUEUE_LEN];
+			dispatcher_tail++;
+		}
+
+		cants_trace(cants_trace_dispatch, msg);
+		type = cants_msg_type(msg);
+		tctm_nack = 0;
+		block_nack = 0;
+		passed = 0;
+
+		/*
+		 * Dispatch messages to appropriate handlers. Only UTM and TS
+		 * messages are handled directly in this task.
+		 */
+		switch (type) {
+		case cants_type_time_sync:
+			cants_time_sync_handler(msg->length, msg->data, cants_msg_time(msg));
+			break;
+		case cants_type_unsolicited_tm:
+			cants_unsolicited_handler(cants_msg_src(msg), cants_msg_cmd(msg), msg->length, msg->data);
+			break;
+		case cants_type_telecommand:
+		case cants_type_telemetry:
+			passed = !nack_only && tctm_process(msg);
+			tctm_nack = !passed;
+			break;
+		case cants_type_set_block:
+		case cants_type_get_block:
+			passed = !nack_only && block_process(msg);
+			block_nack = !passed;
+			break;
 		}
+
+		/* if appropriate queue is full, send nack directly instead of stalling other types */
+		if (tctm_nack)
+			tctm_send_ack(msg, 0);
+
+		if (block_nack)
+			block_send_ack(msg, 0, 1);
+
+		/* message passed to another task is freed there */
+		if (!passed)
+			cants_msg_free(msg);
+
+		taskENTER_CRITICAL();
+		if (tctm_nack || block_nack)
+			stats.rx_nack[type]++;
+		if (!nack_only) {
+			dispatcher_pending[cants_dispatcher_share(type)]--;
+#if CANTS_ISR_ROUTING
+			/* once routed frames passed this way are done, ISR may route directly again */
+			if (cants_isr_routed(type))
+				dispatcher_routed_pending--;
+#endif
+		}
+		taskEXIT_CRITICAL();
 	}
 }
 
 
 void cants_init(const struct cants_keepalive_cfg *cfg)
 {
-	/* initialize TC, TM and block transfer part of stack */
+	/* initialize message pool, TC, TM and block transfer part of stack */
+	cants_msg_pool_init();
 	block_init();
 	tctm_init(cfg);
 
-	/* initialize dispatcher queue */
-	dispatcher_queue = xQueueCreateStatic(DISPATCHER_QUEUE_LEN, sizeof(struct cants_msg),
-		dispatcher_queue_buffer, &dispatcher_queue_struct);
-
-	/* initialize dispatcher task */
-	xTaskCreateStatic(cants_dispatcher, "CANTSDISP", ARRAY_SIZE(dispatcher_task_stack),
+	/* initialize dispatcher task, its ring is empty */
+	dispatcher_task = xTaskCreateStatic(cants_dispatcher, "CANTSDISP", ARRAY_SIZE(dispatcher_task_stack),
 		0, DISPATCHER_PRIORITY, dispatcher_task_stack, &dispatcher_task_buffer);
 }
 
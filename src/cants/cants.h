@@ -26,27 +26,234 @@ enum cants_type {
 	cants_type_telemetry, /**< Telemetry transfer type */
 	cants_type_set_block, /**< Set Block transfer type */
 	cants_type_get_block, /**< Get Block transfer type */
+	cants_types, /**< number of defined transfer types, 3-bit type field may carry undefined ones */
 };
 /**
  *@}
  */
 
+/**
+ * @brief Compile time assertion, compilation fails with negative array size if cond is false
+ */
+#define CANTS_STATIC_ASSERT(cond, name) typedef char cants_static_assert_##name[(cond) ? 1 : -1]
+
+/* CAN-TS fields in 29-bit CAN ID */
+#define CANTS_ID_CMD_SHIFT 0 /**< position of command field */
+#define CANTS_ID_CMD_MASK 0x3ffUL /**< command field mask, before shift */
+#define CANTS_ID_SRC_SHIFT 10 /**< position of source ID field */
+#define CANTS_ID_SRC_MASK 0xffUL /**< source ID field mask, before shift */
+#define CANTS_ID_TYPE_SHIFT 18 /**< position of transfer type field */
+#define CANTS_ID_TYPE_MASK 0x7UL /**< transfer type field mask, before shift */
+#define CANTS_ID_DST_SHIFT 21 /**< position of destination ID field */
+#define CANTS_ID_DST_MASK 0xffUL /**< destination ID field mask, before shift */
+
 /**
  * @struct cants_msg
- * @brief CAN-TS message
+ * @brief CAN-TS message. Packed, because message pool and queues multiply its size.
+ * Fields must be accessed with cants_msg_*() functions below.
  */
 struct cants_msg {
+#if CANTS_RAW_ID
+	uint32_t id; /**< raw 29-bit CAN ID, fields are decoded on access */
+#else
 	uint8_t destination; /**< CAN-TS destination ID */
 	uint8_t type; /**< CAN-TS frame type */
 	uint8_t source; /**< CAN-TS source ID */
 	uint16_t command; /**< CAN-TS command */
+#endif
 	uint8_t length; /**< length of data array */
 	uint8_t data[8]; /**< data in CAN-TS message */
+} CANTS_PACKED;
+/**
+ *@}
+ */
+
+/** size of struct cants_msg without any padding */
+#if CANTS_RAW_ID
+#define CANTS_MSG_SIZE 13
+#else
+#define CANTS_MSG_SIZE 14
+#endif
+
+CANTS_STATIC_ASSERT(sizeof(struct cants_msg) == CANTS_MSG_SIZE, msg_size);
+
+/* message field accessors */
+
+/**
+ * @brief Get destination ID
+ * @param [in] msg CAN-TS message
+ * @retval destination ID
+ */
+static inline uint8_t cants_msg_dst(const struct cants_msg *msg)
+{
+#if CANTS_RAW_ID
+	return (msg->id >> CANTS_ID_DST_SHIFT) & CANTS_ID_DST_MASK;
+#else
+	return msg->destination;
+#endif
+}
+
+/**
+ * @brief Get transfer type
+ * @param [in] msg CAN-TS message
+ * @retval transfer type, see ::cants_type
+ */
+static inline uint8_t cants_msg_type(const struct cants_msg *msg)
+{
+#if CANTS_RAW_ID
+	return (msg->id >> CANTS_ID_TYPE_SHIFT) & CANTS_ID_TYPE_MASK;
+#else
+	return msg->type;
+#endif
+}
+
+/**
+ * @brief Get source ID
+ * @param [in] msg CAN-TS message
+ * @retval source ID
+ */
+static inline uint8_t cants_msg_src(const struct cants_msg *msg)
+{
+#if CANTS_RAW_ID
+	return (msg->id >> CANTS_ID_SRC_SHIFT) & CANTS_ID_SRC_MASK;
+#else
+	return msg->source;
+#endif
+}
+
+/**
+ * @brief Get command field
+ * @param [in] msg CAN-TS message
+ * @retval command
+ */
+static inline uint16_t cants_msg_cmd(const struct cants_msg *msg)
+{
+#if CANTS_RAW_ID
+	return (msg->id >> CANTS_ID_CMD_SHIFT) & CANTS_ID_CMD_MASK;
+#else
+	return msg->command;
+#endif
+}
+
+/**
+ * @brief Set all CAN-TS ID fields
+ * @param [out] msg CAN-TS message
+ * @param [in] dst destination ID
+ * @param [in] type transfer type
+ * @param [in] src source ID
+ * @param [in] cmd command
+ * @retval None
+ */
+static inline void cants_msg_set_id(struct cants_msg *msg, uint8_t dst, uint8_t type,
+		uint8_t src, uint16_t cmd)
+{
+#if CANTS_RAW_ID
+	msg->id = ((uint32_t)dst << CANTS_ID_DST_SHIFT) |
+			  ((uint32_t)(type & CANTS_ID_TYPE_MASK) << CANTS_ID_TYPE_SHIFT) |
+			  ((uint32_t)src << CANTS_ID_SRC_SHIFT) |
+			  ((cmd & CANTS_ID_CMD_MASK) << CANTS_ID_CMD_SHIFT);
+#else
+	msg->destination = dst;
+	msg->type = type;
+	msg->source = src;
+	msg->command = cmd;
+#endif
+}
+
+/**
+ * @brief Set command field, other fields are kept
+ * @param [out] msg CAN-TS message
+ * @param [in] cmd command
+ * @retval None
+ */
+static inline void cants_msg_set_cmd(struct cants_msg *msg, uint16_t cmd)
+{
+#if CANTS_RAW_ID
+	msg->id = (msg->id & ~(CANTS_ID_CMD_MASK << CANTS_ID_CMD_SHIFT)) |
+			  ((cmd & CANTS_ID_CMD_MASK) << CANTS_ID_CMD_SHIFT);
+#else
+	msg->command = cmd;
+#endif
+}
+
+/**
+ * @brief Turn received message into reply: source ID becomes destination ID and
+ * this node becomes source. Type and command are kept.
+ * @param [in,out] msg CAN-TS message
+ * @retval None
+ */
+static inline void cants_msg_reply(struct cants_msg *msg)
+{
+#if CANTS_RAW_ID
+	/* one mask and or on raw ID, no field decoding */
+	msg->id = (msg->id & ~((CANTS_ID_DST_MASK << CANTS_ID_DST_SHIFT) | (CANTS_ID_SRC_MASK << CANTS_ID_SRC_SHIFT))) |
+			  ((msg->id & (CANTS_ID_SRC_MASK << CANTS_ID_SRC_SHIFT)) << (CANTS_ID_DST_SHIFT - CANTS_ID_SRC_SHIFT)) |
+			  ((uint32_t)CANTS_NODE_ID << CANTS_ID_SRC_SHIFT);
+#else
+	msg->destination = msg->source;
+	msg->source = CANTS_NODE_ID;
+#endif
+}
+
+/**
+ * @brief Parse CAN ID field to CAN-TS fields
+ * @param [out] out CAN-TS structure which gets populated with parsed value
+ * @param [in] id CAN ID to parse
+ * @retval None
+ */
+static inline void cants_parse_id(struct cants_msg *out, uint32_t id)
+{
+#if CANTS_RAW_ID
+	/* nothing to parse, fields are decoded on access */
+	out->id = id;
+#else
+	cants_msg_set_id(out, (id >> CANTS_ID_DST_SHIFT) & CANTS_ID_DST_MASK,
+			(id >> CANTS_ID_TYPE_SHIFT) & CANTS_ID_TYPE_MASK,
+			(id >> CANTS_ID_SRC_SHIFT) & CANTS_ID_SRC_MASK,
+			(id >> CANTS_ID_CMD_SHIFT) & CANTS_ID_CMD_MASK);
+#endif
+}
+
+/**
+ * @brief Converts CAN-TS message fileds to CAN ID
+ * @param [in] in CAN-TS message
+ * @retval constructed CAN ID
+ */
+static inline uint32_t cants_construct_id(const struct cants_msg *in)
+{
+#if CANTS_RAW_ID
+	return in->id;
+#else
+	return ((uint32_t)in->destination << CANTS_ID_DST_SHIFT) |
+		   ((uint32_t)(in->type & CANTS_ID_TYPE_MASK) << CANTS_ID_TYPE_SHIFT) |
+		   ((uint32_t)in->source << CANTS_ID_SRC_SHIFT) |
+		   ((in->command & CANTS_ID_CMD_MASK) << CANTS_ID_CMD_SHIFT);
+#endif
+}
+
+/**
+ * @enum cants_trace_point
+ * @brief Points of message processing reported to cants_trace() hook
+ */
+enum cants_trace_point {
+	cants_trace_rx_isr = 0, /**< frame received in CAN interrupt */
+	cants_trace_dispatch, /**< message taken from dispatcher ring or routed from ISR */
+	cants_trace_tc_done, /**< telecommand handler returned */
+	cants_trace_tm_done, /**< telemetry handler returned */
+	cants_trace_send, /**< message passed to cants_send_msg() */
 };
 /**
  *@}
  */
 
+#ifndef cants_trace
+/**
+ * @brief Tracing hook, called with ::cants_trace_point and message. Empty
+ * unless defined in cants_config.h or in CANTS_TRACE_HEADER.
+ */
+#define cants_trace(point, msg)
+#endif
+
 /**
  * @struct cants_keepalive_cfg
  * @brief CAN-TS keep-alive transmission configuration
@@ -60,6 +267,35 @@ struct cants_keepalive_cfg {
  *@}
  */
 
+/**
+ * @enum cants_rx_class
+ * @brief Load shedding classes of received frames. When message pool runs
+ * low, lower classes are dropped first.
+ */
+enum cants_rx_class {
+	cants_rx_bulk = 0, /**< Set Block data frames, lost ones are sent again after SB status */
+	cants_rx_control, /**< TC/TM and block transfer control frames */
+	cants_rx_essential, /**< time sync and unsolicited TM, including keep-alive */
+	cants_rx_classes, /**< number of classes */
+};
+/**
+ *@}
+ */
+
+/**
+ * @struct cants_stats
+ * @brief CAN-TS stack statistics
+ */
+struct cants_stats {
+	uint32_t rx_overflow; /**< received frames dropped, because dispatcher ring was full */
+	uint32_t rx_shed[cants_rx_classes]; /**< received frames dropped by load shedding, per ::cants_rx_class */
+	uint32_t rx_dropped[cants_types]; /**< received frames dropped without reply, because their transfer type used up its share of dispatcher ring and nack ring was full */
+	uint32_t rx_nack[cants_types]; /**< requests nacked by dispatcher, because queue of their task was full or their type used up its share of dispatcher ring */
+};
+/**
+ *@}
+ */
+
 /**
  * @brief Initialize CAN-TS stack
  * @param [in] cfg keek-alive transmission configuration
@@ -68,46 +304,114 @@ struct cants_keepalive_cfg {
 void cants_init(const struct cants_keepalive_cfg *cfg);
 
 /**
- * @brief Put CAN-TS message in processing queue from ISR
- * @param [in] msg CAN-TS message to process
- * @retval 1 if message is queued for processing, 0 otherwise
+ * @brief Get CAN-TS stack statistics
+ * @param [out] out statistics
+ * @retval None
+ */
+void cants_get_stats(struct cants_stats *out);
+
+/**
+ * @brief Put CAN-TS message in processing queue from ISR. Dispatcher ring has
+ * single producer, so it must be called only from CAN interrupts, which don't nest.
+ * @param [in] msg CAN-TS message to process, allocated with cants_msg_alloc_isr().
+ * Ownership is passed to the stack, message is freed if it can't be queued.
+ * @retval 1 if context switch is required, 0 otherwise
  */
 uint8_t cants_dispatch_isr(struct cants_msg *msg);
 
-/* utility functions */
+/**
+ * @brief Notify stack about frames leaving CAN transmission queue. Must be
+ * called by FW from TX interrupt, after queued frames were passed to controller.
+ * @param [in] free number of free entries in CAN transmission queue
+ * @retval 1 if context switch is required, 0 otherwise
+ */
+uint8_t cants_tx_done_isr(uint8_t free);
+
+/* message pool */
 
 /**
- * @brief Parse CAN ID field to CAN-TS fields
- * @param [out] out CAN-TS structure which gets populated with parsed value
- * @param [in] id CAN ID to parse
+ * @brief Initialize message pool. Called by cants_init().
  * @retval None
  */
-void cants_parse_id(struct cants_msg *out, uint32_t id);
+void cants_msg_pool_init(void);
 
 /**
- * @brief Converts CAN-TS message fileds to CAN ID
- * @param [in] in CAN-TS message
- * @retval constructed CAN ID
+ * @brief Allocate message from pool. Pool messages are passed between tasks
+ * by reference, so frame is copied only when it is received.
+ * @retval pointer to message or NULL if pool is exhausted
+ */
+struct cants_msg *cants_msg_alloc(void);
+
+/**
+ * @brief Allocate message from pool in ISR, for received frame. Frame may take
+ * any free message, cants_dispatch_isr() drops it by its ::cants_rx_class, if
+ * it would take message from ::CANTS_MSG_POOL_TX_RESERVE.
+ * @retval pointer to message or NULL if pool is exhausted
+ */
+struct cants_msg *cants_msg_alloc_isr(void);
+
+/**
+ * @brief Get number of free messages in pool
+ * @retval number of free messages
  */
-uint32_t cants_construct_id(struct cants_msg *in);
+uint8_t cants_msg_pool_free(void);
+
+/**
+ * @brief Return message to pool
+ * @param [in] msg pooled CAN-TS message
+ * @retval None
+ */
+void cants_msg_free(struct cants_msg *msg);
+
+/**
+ * @brief Return message to pool from ISR
+ * @param [in] msg pooled CAN-TS message
+ * @retval None
+ */
+void cants_msg_free_isr(struct cants_msg *msg);
+
+/**
+ * @brief Store reception time of pooled message. Called by CAN ISR for each received frame.
+ * Time is kept next to the pool, so it doesn't enlarge messages.
+ * @param [in] msg pooled CAN-TS message
+ * @param [in] time reception time in microseconds
+ * @retval None
+ */
+void cants_msg_set_time(struct cants_msg *msg, uint32_t time);
+
+/**
+ * @brief Get reception time of message
+ * @param [in] msg CAN-TS message
+ * @retval reception time in microseconds, 0 for messages not received from bus
+ */
+uint32_t cants_msg_time(const struct cants_msg *msg);
 
 /* these functions must be provided by FW */
 
 /**
  * @brief Send CAN-TS message. End system specific implementation must be provided.
+ * Message is copied, when it is queued, so caller keeps it and may modify
+ * or free it as soon as this call returns.
  * @param [in] msg CAN-TS message to send
  * @param [in] wait_allowed 0 if blocking is not allowed, any other value means allowed
  * @retval 0 if message was not send successfully, any other value means success
  */
 uint8_t cants_send_msg(struct cants_msg *msg, uint8_t wait_allowed);
 
+/**
+ * @brief Get free space in CAN transmission queue. End system specific implementation must be provided.
+ * @retval number of messages, which can currently be queued by cants_send_msg() without blocking
+ */
+uint8_t cants_send_free(void);
+
 /**
  * @brief Time Sync handler. End system specific implementation must be provided.
  * @param [in] length length of data array
  * @param [in] data Time Sync data
+ * @param [in] time reception time in microseconds, see cants_msg_time()
  * @retval None
  */
-void cants_time_sync_handler(uint8_t length, uint8_t *data);
+void cants_time_sync_handler(uint8_t length, uint8_t *data, uint32_t time);
 
 /**
  * @brief Unsolicited Telemetry handler. End system specific implementation must be provided.
@@ -119,6 +423,28 @@ void cants_time_sync_handler(uint8_t length, uint8_t *data);
  */
 void cants_unsolicited_handler(uint8_t source, uint8_t channel, uint8_t length, uint8_t *data);
 
+#if CANTS_ISR_NOTIFY
+/**
+ * @brief Time Sync handler called from CAN ISR for frames sent to ::CANTS_TIME_ID,
+ * instead of cants_time_sync_handler(). End system specific implementation must be provided.
+ * @param [in] length length of data array
+ * @param [in] data Time Sync data
+ * @param [in] time reception time in microseconds, see cants_msg_time()
+ * @retval 1 if context switch is required, 0 otherwise
+ */
+uint8_t cants_time_sync_isr(uint8_t length, uint8_t *data, uint32_t time);
+
+/**
+ * @brief Keep-alive handler called from CAN ISR for Unsolicited Telemetry frames sent to
+ * ::CANTS_KEEPALIVE_ID, instead of cants_unsolicited_handler(). End system specific
+ * implementation must be provided.
+ * @param [in] source Source ID of keep-alive message
+ * @param [in] time reception time in microseconds, see cants_msg_time()
+ * @retval 1 if context switch is required, 0 otherwise
+ */
+uint8_t cants_keepalive_isr(uint8_t source, uint32_t time);
+#endif
+
 /**
  * @brief Telecommand handler. End system specific implementation must be provided.
  * @param [in] channel Telecommand channel
@@ -155,14 +481,34 @@ uint8_t cants_validate_write_address(ADDRESS_TYPE address, uint16_t size);
  */
 uint8_t cants_write_block_handler(ADDRESS_TYPE address, uint8_t *buffer, uint16_t size, uint8_t *done);
 
+#if SB_STREAMING_WRITE
+/**
+ * @brief Set Block stream handler, used instead of cants_write_block_handler() if
+ * ::SB_STREAMING_WRITE is enabled. End system specific implementation must be provided.
+ * It is called every time received data, which follow already passed data without
+ * gaps, grow, so writing overlaps with reception of the rest of the window.
+ * @param [in] address destination address of this part
+ * @param [in] buffer Buffer, which holds data of this part, it is not modified until session ends or continues with next window
+ * @param [in] size Size of this part
+ * @param [in] last non-zero if this is the last part of the window
+ * @param [in] done Address of done flag, which must be set to non-zero value when all parts, including the last one, have been processed.
+ * @retval non-zero value if data processing has started successfully, 0 otherwise
+ */
+uint8_t cants_write_block_stream_handler(ADDRESS_TYPE address, uint8_t *buffer, uint16_t size,
+		uint8_t last, uint8_t *done);
+#endif
+
 /**
  * @brief Read Block handler. End system specific implementation must be provided.
- * @param [in] address Set Block source address
+ * Reading may continue after return, e.g. in another task or in DMA, while request
+ * is acked and other Get Block sessions are served.
+ * @param [in] address Get Block source address
  * @param [out] buffer Buffer into which data is read
- * @param [out] size Size of the request data
- * @retval non-zero if data was read into buffer, 0 otherwise
+ * @param [in] size Size of the request data
+ * @param [in] done Address of done flag, which must be set to non-zero value when data has been read into buffer.
+ * @retval non-zero if reading has started successfully, 0 if address is invalid
  */
-uint8_t cants_read_block_handler(ADDRESS_TYPE address, uint8_t *buffer, uint16_t size);
+uint8_t cants_read_block_handler(ADDRESS_TYPE address, uint8_t *buffer, uint16_t size, uint8_t *done);
 
 #endif
 
@@ -20,6 +20,8 @@
 #define CANTS_TIME_ID 0 /**< broadcast ID on which time sync messages are sent */
 #define CAN_HW_FILTERING 1 /**< 1 if CAN controller will do filtering, 0 otherwise */
 #define CANTS_SEND_KEEPALIVE 1 /**< 1 if keep-alive messages should be sent */
+#define CANTS_ISR_NOTIFY 1 /**< 1 if broadcast keep-alive and time sync frames are passed to FW handlers directly from ISR */
+#define CANTS_ISR_ROUTING 1 /**< 1 if TC/TM and block transfer frames are queued to their tasks directly from ISR, bypassing dispatcher */
 
 #define MAX_SB_SESSIONS 2 /**< number of maximum supported simultaneous SB sessions */
 #define MAX_GB_SESSIONS 2 /**< number of maximum supported simultaneous GB sessions */
@@ -27,8 +29,21 @@
 #define SB_WRITING_INTERVAL 100 /**< how often to check if data processing was completed */
 #define GB_TIMEOUT 1000 /**< GB session timeout from last valid packet received */
 #define GB_BURST_SIZE 8 /**< maximum number of data transfer frames sent in one burst */
-#define GB_BURST_INTERVAL 100 /**< how often to send burst of GB data transfer frames */
+#define GB_BURST_INTERVAL 100 /**< how often to retry GB burst, if no TX complete interrupt resumed it */
+#define GB_TX_RESERVE 4 /**< CAN transmission queue entries GB bursts leave free for other replies */
+#define GB_TX_RESUME 4 /**< free queue entries above GB_TX_RESERVE, at which TX interrupt resumes GB burst */
+#define GB_READING_INTERVAL 10 /**< how often to check if data reading was completed */
+#define GB_READ_AHEAD 1 /**< 1 if next GB window is read into second buffer while current one is being sent */
+#define SB_WINDOW_FRAMES 64 /**< maximum number of 8 byte frames in one SB window, 64 at most */
+#define GB_WINDOW_FRAMES 64 /**< maximum number of 8 byte frames in one GB window, 64 at most */
+#define BLOCK_ARENA_BUFFERS 4 /**< number of window buffers shared by SB and GB sessions, GB read-ahead takes second one if available */
+#ifndef SB_STREAMING_WRITE
+#define SB_STREAMING_WRITE 0 /**< 1 if SB data is passed to cants_write_block_stream_handler() while window is being received, may be set by build */
+#endif
 #define ADDRESS_TYPE uint32_t /**< GB/SB address type */
+#define BITMAP_WORD uint8_t /**< word type of block transfer masks, should match register width of the MCU */
+#define CANTS_RAW_ID 1 /**< 1 if messages carry raw CAN ID and decode fields on access, 0 to store decoded fields */
+#define CANTS_PACKED __attribute__((packed)) /**< removes padding from structures stored in RAM many times */
 
 /* task stack sizes and priorities */
 #define DISPATCHER_STACK_SIZE configMINIMAL_STACK_SIZE
@@ -46,12 +61,38 @@
 #define GETBLOCK_STACK_SIZE configMINIMAL_STACK_SIZE
 #define GETBLOCK_PRIORITY (tskIDLE_PRIORITY + 1)
 
+/*
+ * Message pool. Queues hold only pointers to pooled messages, so pool size
+ * limits number of messages in flight, not sum of queue lengths.
+ */
+#define CANTS_MSG_POOL_SIZE 72 /**< number of messages in pool, less than 255 */
+#define CANTS_MSG_POOL_TX_RESERVE 8 /**< pool messages kept for received time sync and keep-alive frames, replies are sent from copies and don't use pool */
+#define CANTS_SHED_BULK 16 /**< free pool messages above CANTS_MSG_POOL_TX_RESERVE, below which received SB data frames are dropped */
+
 /* queue lengths */
 #define DISPATCHER_QUEUE_LEN 64
 #define TC_QUEUE_LEN 5
 #define TM_QUEUE_LEN 5
 #define SETBLOCK_QUEUE_LEN 64
 #define GETBLOCK_QUEUE_LEN 5
+#define CANTS_QUEUE_BATCH 16 /**< queued messages a task takes after one wait, before it handles timeouts again, at least 1 */
+#define DISPATCHER_NACK_LEN 8 /**< requests over their dispatcher quota, which wait for nack, power of two */
+
+/*
+ * Dispatcher ring entries, which frames of one transfer type may take. Sum
+ * must fit in the ring, so each type always finds its share free. Time sync
+ * and unsolicited TM share the rest. Quota as long as task queue lets burst
+ * fill the queue, while ISR routing is off or dispatcher is behind.
+ */
+#define DISPATCHER_TC_QUOTA TC_QUEUE_LEN
+#define DISPATCHER_TM_QUOTA TM_QUEUE_LEN
+#define DISPATCHER_SB_QUOTA 40
+#define DISPATCHER_GB_QUOTA GETBLOCK_QUEUE_LEN
+
+/* optional header which defines cants_trace() hook, e.g. for benchmarking */
+#ifdef CANTS_TRACE_HEADER
+#include CANTS_TRACE_HEADER
+#endif
 
 #endif
 
@@ -0,0 +1,142 @@
+/**
+ * @file deadline.c
+ *
+ */
+
+/**
+ * @addtogroup CAN-TS
+ * @{
+ */
+
+#include "deadline.h"
+#include "task.h"
+
+/**
+ * @brief Compare expiry of deadlines, tick count may wrap between them
+ * @param [in] a first deadline
+ * @param [in] b second deadline
+ * @retval 1 if a expires before b, 0 otherwise
+ */
+static uint8_t deadline_before(const struct cants_deadline *a, const struct cants_deadline *b)
+{
+	/* expiries are much less than half of tick range apart */
+	return (TickType_t)(a->expiry - b->expiry) > portMAX_DELAY / 2;
+}
+
+/**
+ * @brief Put deadline at given heap position
+ * @param [in] deadlines set of deadlines
+ * @param [in] deadline deadline
+ * @param [in] pos heap position
+ * @retval None
+ */
+static void deadline_place(struct cants_deadlines *deadlines, struct cants_deadline *deadline, uint8_t pos)
+{
+	deadlines->heap[pos] = deadline;
+	deadline->pos = pos;
+}
+
+/**
+ * @brief Move deadline to its place in heap, after it was put at given position
+ * @param [in] deadlines set of deadlines
+ * @param [in] deadline deadline
+ * @param [in] pos current heap position, entry there is overwritten
+ * @retval None
+ */
+static void deadline_sift(struct cants_deadlines *deadlines, struct cants_deadline *deadline, uint8_t pos)
+{
+	uint8_t parent, child;
+
+	/* sift up */
+	while (pos) {
+		parent = (pos - 1) / 2;
+		if (!deadline_before(deadline, deadlines->heap[parent]))
+			break;
+		deadline_place(deadlines, deadlines->heap[parent], pos);
+		pos = parent;
+	}
+
+	/* sift down */
+	while ((child = 2 * pos + 1) < deadlines->count) {
+		if (child + 1 < deadlines->count && deadline_before(deadlines->heap[child + 1], deadlines->heap[child]))
+			child++;
+		if (!deadline_before(deadlines->heap[child], deadline))
+			break;
+		deadline_place(deadlines, deadlines->heap[child], pos);
+		pos = child;
+	}
+
+	deadline_place(deadlines, deadline, pos);
+}
+
+void cants_deadlines_init(struct cants_deadlines *deadlines, struct cants_deadline **heap, uint8_t size)
+{
+	cants_assert(size < CANTS_DEADLINE_NONE);
+
+	deadlines->heap = heap;
+	deadlines->size = size;
+	deadlines->count = 0;
+}
+
+void cants_deadline_init(struct cants_deadline *deadline, uint8_t id)
+{
+	deadline->pos = CANTS_DEADLINE_NONE;
+	deadline->id = id;
+}
+
+void cants_deadline_arm(struct cants_deadlines *deadlines, struct cants_deadline *deadline, TickType_t ticks)
+{
+	deadline->expiry = xTaskGetTickCount() + ticks;
+
+	if (deadline->pos == CANTS_DEADLINE_NONE) {
+		cants_assert(deadlines->count < deadlines->size);
+		deadline_sift(deadlines, deadline, deadlines->count++);
+	} else {
+		deadline_sift(deadlines, deadline, deadline->pos);
+	}
+}
+
+void cants_deadline_disarm(struct cants_deadlines *deadlines, struct cants_deadline *deadline)
+{
+	uint8_t pos = deadline->pos;
+	struct cants_deadline *last;
+
+	if (pos == CANTS_DEADLINE_NONE)
+		return;
+
+	deadline->pos = CANTS_DEADLINE_NONE;
+	last = deadlines->heap[--deadlines->count];
+
+	/* last entry takes place of removed one */
+	if (last != deadline)
+		deadline_sift(deadlines, last, pos);
+}
+
+TickType_t cants_deadlines_wait(const struct cants_deadlines *deadlines)
+{
+	TickType_t left;
+
+	if (!deadlines->count)
+		return portMAX_DELAY;
+
+	left = deadlines->heap[0]->expiry - xTaskGetTickCount();
+
+	return left > portMAX_DELAY / 2 ? 0 : left;
+}
+
+struct cants_deadline *cants_deadlines_expired(struct cants_deadlines *deadlines)
+{
+	struct cants_deadline *deadline;
+
+	if (!deadlines->count || cants_deadlines_wait(deadlines))
+		return NULL;
+
+	deadline = deadlines->heap[0];
+	cants_deadline_disarm(deadlines, deadline);
+
+	return deadline;
+}
+
+/**
+ * @}
+ */
@@ -0,0 +1,99 @@
+/**
+ * @file deadline.h
+ *
+ */
+
+/**
+ * @addtogroup CAN-TS
+ * @{
+ */
+
+#ifndef DEADLINE_H_
+#define DEADLINE_H_
+
+#include "cants.h"
+#include "FreeRTOS.h"
+
+/** position of deadline, which is not armed */
+#define CANTS_DEADLINE_NONE 0xffU
+
+/**
+ * @struct cants_deadline
+ * @brief Session deadline
+ */
+struct cants_deadline {
+	TickType_t expiry; /**< tick count at which deadline expires */
+	uint8_t pos; /**< position in heap, ::CANTS_DEADLINE_NONE if not armed */
+	uint8_t id; /**< owner defined identifier, e.g. session index */
+};
+/**
+ *@}
+ */
+
+/**
+ * @struct cants_deadlines
+ * @brief Set of deadlines owned by one task, kept in binary min-heap, so the
+ * earliest one is always found in constant time
+ */
+struct cants_deadlines {
+	struct cants_deadline **heap; /**< armed deadlines, earliest deadline first */
+	uint8_t size; /**< heap capacity */
+	uint8_t count; /**< number of armed deadlines */
+};
+/**
+ *@}
+ */
+
+/**
+ * @brief Initialize set of deadlines
+ * @param [out] deadlines set of deadlines
+ * @param [in] heap storage for armed deadlines
+ * @param [in] size number of entries in heap, less than ::CANTS_DEADLINE_NONE
+ * @retval None
+ */
+void cants_deadlines_init(struct cants_deadlines *deadlines, struct cants_deadline **heap, uint8_t size);
+
+/**
+ * @brief Initialize deadline in disarmed state
+ * @param [out] deadline deadline
+ * @param [in] id owner defined identifier
+ * @retval None
+ */
+void cants_deadline_init(struct cants_deadline *deadline, uint8_t id);
+
+/**
+ * @brief Arm deadline, or move already armed one
+ * @param [in] deadlines set of deadlines
+ * @param [in] deadline deadline
+ * @param [in] ticks time from now until deadline
+ * @retval None
+ */
+void cants_deadline_arm(struct cants_deadlines *deadlines, struct cants_deadline *deadline, TickType_t ticks);
+
+/**
+ * @brief Disarm deadline, nothing is done if it isn't armed
+ * @param [in] deadlines set of deadlines
+ * @param [in] deadline deadline
+ * @retval None
+ */
+void cants_deadline_disarm(struct cants_deadlines *deadlines, struct cants_deadline *deadline);
+
+/**
+ * @brief Get time until the earliest deadline
+ * @param [in] deadlines set of deadlines
+ * @retval number of ticks, 0 if deadline has passed, portMAX_DELAY if no deadline is armed
+ */
+TickType_t cants_deadlines_wait(const struct cants_deadlines *deadlines);
+
+/**
+ * @brief Disarm and return deadline, which has expired
+ * @param [in] deadlines set of deadlines
+ * @retval the earliest expired deadline, NULL if none has expired
+ */
+struct cants_deadline *cants_deadlines_expired(struct cants_deadlines *deadlines);
+
+#endif
+
+/**
+ * @}
+ */
@@ -0,0 +1,136 @@
+/**
+ * @file msgpool.c
+ *
+ */
+
+/**
+ * @addtogroup CAN-TS
+ * @{
+ */
+
+#include "cants.h"
+#include "FreeRTOS.h"
+#include "task.h"
+
+/** marks end of free list */
+#define MSGPOOL_NONE 0xff
+
+#if CANTS_MSG_POOL_SIZE >= MSGPOOL_NONE
+#error "CANTS_MSG_POOL_SIZE must be less than 255"
+#endif
+
+/* pool storage and state of each slot */
+static struct cants_msg pool[CANTS_MSG_POOL_SIZE];
+static uint8_t next_free[CANTS_MSG_POOL_SIZE];
+static uint32_t rx_time[CANTS_MSG_POOL_SIZE];
+
+/* free list */
+static uint8_t free_head;
+static volatile uint8_t free_count;
+
+/**
+ * @brief Take slot from free list. Must be called with interrupts disabled.
+ * @retval pointer to message or NULL if pool is exhausted
+ */
+static struct cants_msg *msgpool_get(void)
+{
+	uint8_t index = free_head;
+
+	if (!free_count)
+		return NULL;
+
+	free_head = next_free[index];
+	free_count--;
+	rx_time[index] = 0;
+
+	return &pool[index];
+}
+
+/**
+ * @brief Return slot to free list. Must be called with interrupts disabled.
+ * @param [in] msg pooled message
+ * @retval None
+ */
+static void msgpool_put(struct cants_msg *msg)
+{
+	uint8_t index = msg - pool;
+
+	cants_assert(msg >= pool && msg < pool + CANTS_MSG_POOL_SIZE);
+
+	next_free[index] = free_head;
+	free_head = index;
+	free_count++;
+}
+
+void cants_msg_pool_init(void)
+{
+	uint8_t i;
+
+	for (i = 0; i < CANTS_MSG_POOL_SIZE; i++)
+		next_free[i] = i + 1 < CANTS_MSG_POOL_SIZE ? i + 1 : MSGPOOL_NONE;
+
+	free_head = 0;
+	free_count = CANTS_MSG_POOL_SIZE;
+}
+
+struct cants_msg *cants_msg_alloc(void)
+{
+	struct cants_msg *msg;
+
+	taskENTER_CRITICAL();
+	msg = msgpool_get();
+	taskEXIT_CRITICAL();
+
+	return msg;
+}
+
+struct cants_msg *cants_msg_alloc_isr(void)
+{
+	UBaseType_t mask = taskENTER_CRITICAL_FROM_ISR();
+	/* frame type isn't known yet, TX reserve is kept by cants_dispatch_isr() */
+	struct cants_msg *msg = msgpool_get();
+
+	taskEXIT_CRITICAL_FROM_ISR(mask);
+
+	return msg;
+}
+
+uint8_t cants_msg_pool_free(void)
+{
+	return free_count;
+}
+
+void cants_msg_free(struct cants_msg *msg)
+{
+	taskENTER_CRITICAL();
+	msgpool_put(msg);
+	taskEXIT_CRITICAL();
+}
+
+void cants_msg_free_isr(struct cants_msg *msg)
+{
+	UBaseType_t mask = taskENTER_CRITICAL_FROM_ISR();
+
+	msgpool_put(msg);
+	taskEXIT_CRITICAL_FROM_ISR(mask);
+}
+
+void cants_msg_set_time(struct cants_msg *msg, uint32_t time)
+{
+	cants_assert(msg >= pool && msg < pool + CANTS_MSG_POOL_SIZE);
+
+	/* only owner of freshly allocated message writes it, no locking needed */
+	rx_time[msg - pool] = time;
+}
+
+uint32_t cants_msg_time(const struct cants_msg *msg)
+{
+	if (msg < pool || msg >= pool + CANTS_MSG_POOL_SIZE)
+		return 0;
+
+	return rx_time[msg - pool];
+}
+
+/**
+ * @}
+ */
@@ -16,11 +16,11 @@
 /* TC & TM task related buffers */
 static QueueHandle_t tc_queue = NULL;
 static StaticQueue_t tc_queue_struct;
-static uint8_t tc_queue_buffer[TC_QUEUE_LEN * sizeof(struct cants_msg)];
+static uint8_t tc_queue_buffer[TC_QUEUE_LEN * sizeof(struct cants_msg *)];
 
 static QueueHandle_t tm_queue = NULL;
 static StaticQueue_t tm_queue_struct;
-static uint8_t tm_queue_buffer[TM_QUEUE_LEN * sizeof(struct cants_msg)];
+static uint8_t tm_queue_buffer[TM_QUEUE_LEN * sizeof(struct cants_msg *)];
 
 /* TC & TM queue related buffers */
 static StaticTask_t tc_task_buffer;
@@ -43,20 +43,18 @@ static struct cants_keepalive_cfg config;
 static void cants_send_keepalive(void)
 {
 	struct cants_msg msg;
-	uint8_t ack = 0;
+	uint8_t ack = 0, channel = 0;
 
 	/* read next telemetry channel to send, skip unavailable/invalid */
 	while (!ack) {
 		ack = cants_telemetry_handler(utm_ch, &msg.length, msg.data);
-		msg.command = utm_ch;
+		channel = utm_ch;
 		if (++utm_ch > config.utm_ch_max)
 			utm_ch = config.utm_ch_min;
 	}
 
 	/* destination address is predefined */
-	msg.destination = CANTS_KEEPALIVE_ID;
-	msg.source = CANTS_NODE_ID;
-	msg.type = cants_type_unsolicited_tm;
+	cants_msg_set_id(&msg, CANTS_KEEPALIVE_ID, cants_type_unsolicited_tm, CANTS_NODE_ID, channel);
 
 	cants_send_msg(&msg, 1);
 }
@@ -73,8 +71,8 @@ static void cants_tm(void *arg)
     TickType_t wait_time = config.period;
     TimeOut_t timeout;
 #endif
-	struct cants_msg msg;
-	uint8_t ack, channel;
+	struct cants_msg *msg;
+	uint8_t ack, channel, batch;
 
 	(void)arg;
 
@@ -88,12 +86,18 @@ static void cants_tm(void *arg)
 #else
 		if (xQueueReceive(tm_queue, &msg, portMAX_DELAY)) {
 #endif
-			/* Ignore non-telemetry requests or those with data */
-			if (msg.type == cants_type_telemetry && msg.length == 0) {
-					channel = msg.command & 0xff;
-					ack = cants_telemetry_handler(channel, &msg.length, msg.data);
-					tctm_send_ack(&msg, ack);
-			}
+			/* keep-alive period is checked once per batch of queued requests */
+			batch = CANTS_QUEUE_BATCH;
+			do {
+				/* Ignore non-telemetry requests or those with data */
+				if (cants_msg_type(msg) == cants_type_telemetry && msg->length == 0) {
+					channel = cants_msg_cmd(msg) & 0xff;
+					ack = cants_telemetry_handler(channel, &msg->length, msg->data);
+					cants_trace(cants_trace_tm_done, msg);
+					tctm_send_ack(msg, ack);
+				}
+				cants_msg_free(msg);
+			} while (--batch && xQueueReceive(tm_queue, &msg, 0));
 		}
 
 #if CANTS_SEND_KEEPALIVE
@@ -116,7 +120,7 @@ static void cants_tm(void *arg)
  */
 static void cants_tc(void *arg)
 {
-	struct cants_msg msg;
+	struct cants_msg *msg;
 	uint8_t ack, channel;
 
 	(void)arg;
@@ -124,11 +128,13 @@ static void cants_tc(void *arg)
 	while (1) {
 		if (xQueueReceive(tc_queue, &msg, portMAX_DELAY)) {
 			/* Ignore non-telecommand messages. At this point, there shouldn't be any. */
-			if (msg.type == cants_type_telecommand) {
-				channel = msg.command & 0xff;
-				ack = cants_telecommand_handler(channel, msg.length, msg.data);
-				tctm_send_ack(&msg, ack);
+			if (cants_msg_type(msg) == cants_type_telecommand) {
+				channel = cants_msg_cmd(msg) & 0xff;
+				ack = cants_telecommand_handler(channel, msg->length, msg->data);
+				cants_trace(cants_trace_tc_done, msg);
+				tctm_send_ack(msg, ack);
 			}
+			cants_msg_free(msg);
 		}
 	}
 }
@@ -139,10 +145,10 @@ void tctm_init(const struct cants_keepalive_cfg *cfg)
 	utm_ch = config.utm_ch_min;
 
 	/* initialize TC and TM queues */
-	tc_queue = xQueueCreateStatic(TC_QUEUE_LEN, sizeof(struct cants_msg),
+	tc_queue = xQueueCreateStatic(TC_QUEUE_LEN, sizeof(struct cants_msg *),
 			tc_queue_buffer, &tc_queue_struct);
 
-	tm_queue = xQueueCreateStatic(TM_QUEUE_LEN, sizeof(struct cants_msg),
+	tm_queue = xQueueCreateStatic(TM_QUEUE_LEN, sizeof(struct cants_msg *),
 			tm_queue_buffer, &tm_queue_struct);
 
 	/* initialize TC and TM tasks */
@@ -156,31 +162,42 @@ void tctm_init(const struct cants_keepalive_cfg *cfg)
 uint8_t tctm_process(struct cants_msg *msg)
 {
 	/* ignore if it's not TC/TM request */
-	if ((msg->command & TCTM_RA_MASK) != TCTM_RA_REQUEST)
+	uint8_t type = cants_msg_type(msg);
+
+	if ((cants_msg_cmd(msg) & TCTM_RA_MASK) != TCTM_RA_REQUEST)
 		return 0;
 
-	/* dispatch to correct task */
-	if (msg->type == cants_type_telemetry)
-		return xQueueSendToBack(tm_queue, msg, pdMS_TO_TICKS(10)) != errQUEUE_FULL;
+	/* dispatch to correct task, dispatcher nacks the request if its queue is full */
+	if (type == cants_type_telemetry)
+		return xQueueSendToBack(tm_queue, &msg, 0) != errQUEUE_FULL;
 
-	if (msg->type == cants_type_telecommand)
-		return xQueueSendToBack(tc_queue, msg, pdMS_TO_TICKS(10)) != errQUEUE_FULL;
+	if (type == cants_type_telecommand)
+		return xQueueSendToBack(tc_queue, &msg, 0) != errQUEUE_FULL;
 
 	return 0;
 }
 
+uint8_t tctm_process_isr(struct cants_msg *msg, BaseType_t *yield)
+{
+	QueueHandle_t queue = cants_msg_type(msg) == cants_type_telemetry ? tm_queue : tc_queue;
+
+	/* only requests are routed, full queue is left to dispatcher, which nacks */
+	if ((cants_msg_cmd(msg) & TCTM_RA_MASK) != TCTM_RA_REQUEST || xQueueIsQueueFullFromISR(queue))
+		return 0;
+
+	return xQueueSendToBackFromISR(queue, &msg, yield) == pdTRUE;
+}
+
 void tctm_send_ack(struct cants_msg *msg, uint8_t ack)
 {
 	/* set source and destination address */
-	msg->destination = msg->source;
-	msg->source = CANTS_NODE_ID;
+	cants_msg_reply(msg);
 
 	/* set ack or nack flag */
-	msg->command &= ~TCTM_RA_MASK;
-	msg->command |= ack ? TCTM_RA_ACK : TCTM_RA_NACK;
+	cants_msg_set_cmd(msg, (cants_msg_cmd(msg) & ~TCTM_RA_MASK) | (ack ? TCTM_RA_ACK : TCTM_RA_NACK));
 
 	/* set size to 0 for telecommands or nack */
-	if (msg->type == cants_type_telecommand || !ack)
+	if (cants_msg_type(msg) == cants_type_telecommand || !ack)
 		msg->length = 0;
 
 	cants_send_msg(msg, 1);
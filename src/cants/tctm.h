@@ -12,6 +12,7 @@
 #define TCTM_H_
 
 #include "cants.h"
+#include "FreeRTOS.h"
 
 /**
  * @name TC/TM Request/Acknowledge definitions
@@ -33,12 +34,20 @@
 void tctm_init(const struct cants_keepalive_cfg *cfg);
 
 /**
- * @brief Process TC/TM message
- * @param [in] msg CAN-TS message
+ * @brief Process TC/TM message. Doesn't wait for space in full queue.
+ * @param [in] msg pooled CAN-TS message, owned by TC/TM task if accepted
  * @retval Non-zero if message has beed accepted for processing, 0 otherwise
  */
 uint8_t tctm_process(struct cants_msg *msg);
 
+/**
+ * @brief Put TC/TM request directly into TC or TM queue from ISR
+ * @param [in] msg pooled TC/TM message, owned by TC/TM task if accepted
+ * @param [out] yield set to pdTRUE if context switch is required
+ * @retval Non-zero if message has beed accepted, 0 if it's not a request or queue is full
+ */
+uint8_t tctm_process_isr(struct cants_msg *msg, BaseType_t *yield);
+
 /**
  * @brief Modify message into TC/TM ack/nack
  * @param [in] msg TC/TM request message
@@ -8,12 +8,16 @@
 
 static uint8_t data[0x100]; /**< buffer for holding data written by Set Block transfer */
 
-uint8_t cants_read_block_handler(ADDRESS_TYPE address, uint8_t *buffer, uint16_t size)
+uint8_t cants_read_block_handler(ADDRESS_TYPE address, uint8_t *buffer, uint16_t size, uint8_t *done)
 {
 	/* validate address */
 	if (address + size <= 0x100) {
-		/* copy requested data */
+		/*
+		 * Copy requested data. Memory is fast, so done flag is set
+		 * immediatelly, slow device would set it when reading finishes.
+		 */
 		memcpy(buffer, &data[address], size);
+		*done = 1;
 
 		return 1;
 	}
@@ -48,6 +52,21 @@ uint8_t cants_write_block_handler(ADDRESS_TYPE address, uint8_t *buffer, uint16_
 	return 1;
 }
 
+#if SB_STREAMING_WRITE
+uint8_t cants_write_block_stream_handler(ADDRESS_TYPE address, uint8_t *buffer, uint16_t size,
+		uint8_t last, uint8_t *done)
+{
+	/* address of whole window was already validated */
+	memcpy(&data[address], buffer, size);
+
+	/* processing of window is finished with its last part */
+	if (last)
+		*done = 1;
+
+	return 1;
+}
+#endif
+
 /**
  * @}
  */
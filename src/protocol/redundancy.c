@@ -19,6 +19,30 @@ static StaticTask_t redundancy_task_buffer;
 static StackType_t redundancy_task_stack[REDUNDANCY_STACK_SIZE];
 static TaskHandle_t task_hdl;
 
+/* tick count at reception of last redundancy master keep-alive */
+static TickType_t keepalive_time;
+
+#if CANTS_ISR_NOTIFY
+uint8_t cants_keepalive_isr(uint8_t source, uint32_t time)
+{
+	BaseType_t yield = pdFALSE;
+	UBaseType_t mask;
+
+	/* timeout is counted in ticks, microsecond reception time isn't needed */
+	(void)time;
+
+	/* notify task we received redundancy master keep-alive message */
+	if (source == REDUNDANCY_MASTER_ID) {
+		mask = taskENTER_CRITICAL_FROM_ISR();
+		keepalive_time = xTaskGetTickCountFromISR();
+		taskEXIT_CRITICAL_FROM_ISR(mask);
+		vTaskNotifyGiveFromISR(task_hdl, &yield);
+	}
+
+	return yield == pdTRUE;
+}
+#endif
+
 void cants_unsolicited_handler(uint8_t source, uint8_t channel, uint8_t length, uint8_t *data)
 {
 	(void)channel;
@@ -26,8 +50,12 @@ void cants_unsolicited_handler(uint8_t source, uint8_t channel, uint8_t length,
 	(void)data;
 
 	/* notify task we received redundancy master keep-alive message */
-	if (source == REDUNDANCY_MASTER_ID)
+	if (source == REDUNDANCY_MASTER_ID) {
+		taskENTER_CRITICAL();
+		keepalive_time = xTaskGetTickCount();
+		taskEXIT_CRITICAL();
 		xTaskNotifyGive(task_hdl);
+	}
 
 	/* If UTM was send directly to us, we have to process it. */
 }
@@ -38,15 +66,29 @@ void cants_unsolicited_handler(uint8_t source, uint8_t channel, uint8_t length,
  */
 static void redundancy_task(void *arg)
 {
+	TickType_t deadline = xTaskGetTickCount() + REDUNDANCY_PERIOD, wait;
 	uint8_t misses = 0, switches = 0, bus = 0;
 	(void)arg;
 
 	while (1) {
-		if (ulTaskNotifyTake(pdTRUE, REDUNDANCY_PERIOD)) {
+		/* deadline may have passed while task wasn't running */
+		wait = deadline - xTaskGetTickCount();
+		if (wait > REDUNDANCY_PERIOD)
+			wait = 0;
+
+		if (ulTaskNotifyTake(pdTRUE, wait)) {
 			/* clear counters if keep-alive message is received */
 			misses = 0;
 			switches = 0;
-		} else if (++misses >= REDUNDANCY_MAX_MISSES) {
+			/* next one is expected a period after reception, not after this task woke up */
+			taskENTER_CRITICAL();
+			deadline = keepalive_time + REDUNDANCY_PERIOD;
+			taskEXIT_CRITICAL();
+			continue;
+		}
+
+		deadline += REDUNDANCY_PERIOD;
+		if (++misses >= REDUNDANCY_MAX_MISSES) {
 			if (switches < REDUNDANCY_MAX_SWITCHES) {
 				/* switch CAN bus */
 				bus = !bus;
@@ -0,0 +1,356 @@
+/**
+ * @file sctime.c
+ *
+ */
+
+/**
+ * @addtogroup cants_app CAN-TS application level
+ * @{
+ */
+
+#include <string.h>
+
+#include "cants.h"
+#include "FreeRTOS.h"
+#include "sctime.h"
+#include "soc.h"
+#include "task.h"
+#include "timer.h"
+
+/*
+ * Local clock is FreeRTOS tick count, with fraction of the tick taken from
+ * tick timer TIM0, whose counter runs at SOC_CLOCK. Dedicated timer would
+ * need its own overflow interrupt.
+ */
+#define SCTIME_US_PER_TICK (1000000UL / configTICK_RATE_HZ)
+#define SCTIME_CYCLES_PER_US (SOC_CLOCK / 1000000UL)
+#define SCTIME_CYCLES_PER_TICK (SOC_CLOCK / configTICK_RATE_HZ)
+
+#if SOC_CLOCK % 1000000UL || 1000000UL % configTICK_RATE_HZ || SCTIME_CYCLES_PER_TICK > 0x10000UL
+#error "TIM0 must run at whole number of MHz without prescaler and tick must last whole number of microseconds"
+#endif
+
+/**
+ * @struct sctime_sample
+ * @brief Time Sync frame waiting to be applied to the clock
+ */
+struct sctime_sample {
+	uint64_t local; /**< local time at reception */
+	uint8_t length; /**< length of data array */
+	uint8_t data[8]; /**< Time Sync data */
+};
+/**
+ *@}
+ */
+
+#if CANTS_ISR_NOTIFY
+/* task related globals */
+static StaticTask_t sctime_task_buffer;
+static StackType_t sctime_task_stack[SCTIME_STACK_SIZE];
+static TaskHandle_t task_hdl;
+#endif
+
+/* last received Time Sync frame, written from ISR and applied by task */
+static struct sctime_sample sample;
+static uint8_t sample_pending;
+
+/*
+ * Clock model: spacecraft time model_ref at local time model_local, advancing
+ * with drift compensated rate. Drift is measured from drift_local/drift_ref,
+ * as syncs may come too often for short interval to be precise. Model is
+ * written only by the task, which applies Time Sync frames, and read by
+ * others in critical section.
+ */
+static uint64_t model_local;
+static uint64_t model_ref;
+static uint64_t drift_local;
+static uint64_t drift_ref;
+static int32_t model_drift;
+static uint8_t model_valid;
+static uint8_t outliers;
+
+/*
+ * Tick count at last read and number of its wraps, which extend it beyond
+ * 32 bits. Wrap is noticed by the next read, so tick count must be read at
+ * least once per wrap, time task makes sure of that, if it is present.
+ */
+static TickType_t last_ticks;
+static uint8_t tick_epoch;
+
+/**
+ * @brief Read tick count and TIM0 counter. Must be called with interrupts disabled.
+ * @param [out] ticks tick count
+ * @param [out] epoch number of tick count wraps
+ * @retval microseconds since start of the tick
+ */
+static uint16_t sctime_read(TickType_t *ticks, uint8_t *epoch)
+{
+	uint16_t count = timer_get_count(TIM0);
+	TickType_t now = xTaskGetTickCountFromISR();
+
+	/* counter already wrapped, but tick interrupt is still waiting */
+	if (timer_is_overflow(TIM0) && count < SCTIME_CYCLES_PER_TICK / 2)
+		now++;
+
+	if (now < last_ticks)
+		tick_epoch++;
+	last_ticks = now;
+
+	*ticks = now;
+	*epoch = tick_epoch;
+
+	return count / SCTIME_CYCLES_PER_US;
+}
+
+/**
+ * @brief Get local time, extended over tick count overflow. Must be called with interrupts disabled.
+ * @retval time since scheduler start in microseconds
+ */
+static uint64_t sctime_local64(void)
+{
+	TickType_t ticks;
+	uint8_t epoch;
+	uint16_t us = sctime_read(&ticks, &epoch);
+
+	return (((uint64_t)epoch << 32) + ticks) * SCTIME_US_PER_TICK + us;
+}
+
+uint32_t sctime_local(void)
+{
+	TickType_t ticks;
+	uint8_t epoch;
+	uint16_t us = sctime_read(&ticks, &epoch);
+
+	/* same as low part of sctime_local64(), without 64-bit arithmetic */
+	return ticks * SCTIME_US_PER_TICK + us;
+}
+
+/**
+ * @brief Extrapolate spacecraft time
+ * @param [in] ref spacecraft time at start of interval
+ * @param [in] elapsed local time elapsed since then
+ * @param [in] drift drift estimate
+ * @retval spacecraft time in microseconds
+ */
+static uint64_t sctime_predict(uint64_t ref, uint64_t elapsed, int32_t drift)
+{
+	uint64_t correction = (elapsed * (uint32_t)(drift < 0 ? -drift : drift)) >> SCTIME_DRIFT_FRAC;
+
+	return drift < 0 ? ref + elapsed - correction : ref + elapsed + correction;
+}
+
+/**
+ * @brief Convert Time Sync data to spacecraft time
+ * @param [in] length length of data array, from 4 to 8
+ * @param [in] data Time Sync data
+ * @retval spacecraft time in microseconds
+ */
+static uint64_t sctime_decode(uint8_t length, const uint8_t *data)
+{
+	uint32_t seconds = 0, fraction = 0;
+	uint8_t i;
+
+	for (i = 0; i < 4; i++)
+		seconds = seconds << 8 | data[i];
+	for (; i < length; i++)
+		fraction = fraction << 8 | data[i];
+
+	return (uint64_t)seconds * 1000000UL + (((uint64_t)fraction * 1000000UL) >> (8 * (length - 4)));
+}
+
+uint8_t sctime_encode(uint64_t time, uint8_t *data)
+{
+	uint32_t seconds = time / 1000000UL;
+	uint32_t fraction = ((time % 1000000UL) << 24) / 1000000UL;
+	uint8_t i;
+
+	for (i = 0; i < 4; i++)
+		data[i] = seconds >> (24 - 8 * i);
+	for (i = 0; i < 3; i++)
+		data[4 + i] = fraction >> (16 - 8 * i);
+
+	return 7;
+}
+
+/**
+ * @brief Store received Time Sync frame. Must be called with interrupts disabled.
+ * @param [in] length length of data array
+ * @param [in] data Time Sync data
+ * @param [in] time reception time, see cants_msg_time()
+ * @retval None
+ */
+static void sctime_store(uint8_t length, const uint8_t *data, uint32_t time)
+{
+	uint64_t local;
+
+	if (length < 4 || length > 8)
+		return;
+
+	/* reception time is low part of local time, frame is much younger than its wrap */
+	local = sctime_local64();
+	sample.local = local - (uint32_t)((uint32_t)local - time);
+	sample.length = length;
+	memcpy(sample.data, data, length);
+	sample_pending = 1;
+}
+
+/**
+ * @brief Apply last received Time Sync frame to clock model
+ * @retval None
+ */
+static void sctime_update(void)
+{
+	struct sctime_sample s;
+	uint64_t ref, interval;
+	uint8_t pending;
+	int64_t error, limit;
+	int32_t drift;
+
+	taskENTER_CRITICAL();
+	pending = sample_pending;
+	s = sample;
+	sample_pending = 0;
+	taskEXIT_CRITICAL();
+
+	if (!pending)
+		return;
+
+	/* 64-bit arithmetic takes too long to be done with interrupts disabled */
+	ref = sctime_decode(s.length, s.data);
+
+	if (model_valid) {
+		interval = s.local - drift_local;
+		error = ref - sctime_predict(drift_ref, interval, model_drift);
+
+		/* estimate may be off by twice the maximum drift */
+		limit = SCTIME_MAX_JITTER + (int64_t)((interval * SCTIME_MAX_DRIFT) >> (SCTIME_DRIFT_FRAC - 1));
+
+		if (error > limit || error < -limit) {
+			/* late frame is ignored, but few of them mean that time was set */
+			if (++outliers <= SCTIME_MAX_OUTLIERS)
+				return;
+
+			/* restart drift measurement, but keep estimate */
+			drift_local = s.local;
+			drift_ref = ref;
+		} else if (interval >= SCTIME_MIN_INTERVAL) {
+			/* error of prediction is residual drift over interval */
+			drift = model_drift + ((error * (1L << SCTIME_DRIFT_FRAC) / (int64_t)interval) / (1 << SCTIME_DRIFT_SHIFT));
+			if (drift > SCTIME_MAX_DRIFT)
+				drift = SCTIME_MAX_DRIFT;
+			if (drift < -SCTIME_MAX_DRIFT)
+				drift = -SCTIME_MAX_DRIFT;
+
+			taskENTER_CRITICAL();
+			model_drift = drift;
+			taskEXIT_CRITICAL();
+
+			drift_local = s.local;
+			drift_ref = ref;
+		}
+	} else {
+		drift_local = s.local;
+		drift_ref = ref;
+	}
+
+	/* time is set by each sync, drift only affects extrapolation */
+	outliers = 0;
+	taskENTER_CRITICAL();
+	model_local = s.local;
+	model_ref = ref;
+	model_valid = 1;
+	taskEXIT_CRITICAL();
+}
+
+uint64_t sctime_now(void)
+{
+	uint64_t local, ref, anchor;
+	int32_t drift;
+	uint8_t valid;
+
+	taskENTER_CRITICAL();
+	local = sctime_local64();
+	anchor = model_local;
+	ref = model_ref;
+	drift = model_drift;
+	valid = model_valid;
+	taskEXIT_CRITICAL();
+
+	if (!valid)
+		return 0;
+
+	return sctime_predict(ref, local - anchor, drift);
+}
+
+int32_t sctime_drift(void)
+{
+	int32_t drift;
+
+	taskENTER_CRITICAL();
+	drift = model_drift;
+	taskEXIT_CRITICAL();
+
+	return drift;
+}
+
+void cants_time_sync_handler(uint8_t length, uint8_t *data, uint32_t time)
+{
+	taskENTER_CRITICAL();
+	sctime_store(length, data, time);
+	taskEXIT_CRITICAL();
+
+#if CANTS_ISR_NOTIFY
+	/* task is the only one, which updates clock model, dispatcher could preempt it */
+	xTaskNotifyGive(task_hdl);
+#else
+	sctime_update();
+#endif
+}
+
+#if CANTS_ISR_NOTIFY
+uint8_t cants_time_sync_isr(uint8_t length, uint8_t *data, uint32_t time)
+{
+	BaseType_t yield = pdFALSE;
+	UBaseType_t mask = taskENTER_CRITICAL_FROM_ISR();
+
+	/* frame is only stored, it is applied by the task */
+	sctime_store(length, data, time);
+	taskEXIT_CRITICAL_FROM_ISR(mask);
+	vTaskNotifyGiveFromISR(task_hdl, &yield);
+
+	return yield == pdTRUE;
+}
+
+/**
+ * @brief Time task. Applies Time Sync frames stored by ISR or dispatcher to the clock.
+ * @retval None
+ */
+static void sctime_task(void *arg)
+{
+	(void)arg;
+
+	while (1) {
+		/* without Time Sync frames tick count is still read twice per wrap */
+		if (ulTaskNotifyTake(pdTRUE, portMAX_DELAY / 2)) {
+			sctime_update();
+		} else {
+			taskENTER_CRITICAL();
+			(void)sctime_local();
+			taskEXIT_CRITICAL();
+		}
+	}
+}
+#endif
+
+void sctime_init(void)
+{
+#if CANTS_ISR_NOTIFY
+	/* frames are only stored on reception, task applies them */
+	task_hdl = xTaskCreateStatic(sctime_task, "TIME", ARRAY_SIZE(sctime_task_stack),
+				NULL, SCTIME_PRIORITY, sctime_task_stack, &sctime_task_buffer);
+#endif
+}
+
+/**
+ * @}
+ */
@@ -0,0 +1,88 @@
+/**
+ * @file sctime.h
+ *
+ */
+
+/**
+ * @addtogroup cants_app CAN-TS application level
+ * @{
+ */
+
+#ifndef SCTIME_H_
+#define SCTIME_H_
+
+#include <stdint.h>
+
+/*
+ * Spacecraft time service. Local clock is FreeRTOS tick count extended with
+ * TIM0 counter. It is disciplined by Time Sync frames: each one sets the time
+ * (phase) and error of previous prediction adjusts drift (frequency)
+ * estimate, so time between syncs is extrapolated with compensated rate.
+ * Frame with error, which can't be explained by jitter and drift, is ignored,
+ * unless it is followed by similar ones, in which case time was set.
+ *
+ * Time Sync data holds 4 byte big-endian seconds, followed by up to 4 bytes of
+ * big-endian binary fraction of second.
+ */
+
+/** Time task stack size */
+#define SCTIME_STACK_SIZE configMINIMAL_STACK_SIZE
+/** Time task priority */
+#define SCTIME_PRIORITY (tskIDLE_PRIORITY + 1)
+
+/** fixed point position of drift, which is in parts per 2^SCTIME_DRIFT_FRAC */
+#define SCTIME_DRIFT_FRAC 24
+
+/** drift filter gain is 1/2^SCTIME_DRIFT_SHIFT of each measured error */
+#define SCTIME_DRIFT_SHIFT 3
+
+/** maximum drift estimate, about 500 ppm */
+#define SCTIME_MAX_DRIFT 8389L
+
+/** maximum jitter of Time Sync frame reception in microseconds, e.g. due to bus arbitration */
+#define SCTIME_MAX_JITTER 200L
+
+/** number of consecutive Time Sync frames ignored as outliers, before time is stepped */
+#define SCTIME_MAX_OUTLIERS 2
+
+/** minimum interval between syncs in microseconds, for which drift is updated */
+#define SCTIME_MIN_INTERVAL 50000UL
+
+/**
+ * @brief Initialize time task, which applies received Time Sync frames
+ * @retval None
+ */
+void sctime_init(void);
+
+/**
+ * @brief Get local time. Must be called from ISR or with interrupts disabled.
+ * Wraps after about 71 minutes, CAN frames are timestamped with it.
+ * @retval time since scheduler start in microseconds
+ */
+uint32_t sctime_local(void);
+
+/**
+ * @brief Get spacecraft time. Must not be called from ISR.
+ * @retval microseconds since spacecraft epoch, 0 until first Time Sync frame is received
+ */
+uint64_t sctime_now(void);
+
+/**
+ * @brief Get drift estimate of local clock. Must not be called from ISR.
+ * @retval drift in parts per 2^SCTIME_DRIFT_FRAC, positive if local clock is slow
+ */
+int32_t sctime_drift(void);
+
+/**
+ * @brief Convert spacecraft time to Time Sync data format
+ * @param [in] time spacecraft time in microseconds
+ * @param [out] data 4 bytes of seconds and 3 bytes of fraction of second
+ * @retval number of bytes written to data
+ */
+uint8_t sctime_encode(uint64_t time, uint8_t *data);
+
+#endif
+
+/**
+ * @}
+ */
@@ -10,6 +10,7 @@
 
 #include "cants.h"
 #include "gpio.h"
+#include "sctime.h"
 #include "soc.h"
 #include "telemetry.h"
 
@@ -23,6 +24,18 @@ uint8_t cants_telemetry_handler(uint8_t channel, uint8_t *length, uint8_t *data)
 		return 1;
 	}
 
+	/* report spacecraft time, unless it wasn't synchronized yet */
+	if (channel == TM_SPACECRAFT_TIME) {
+		uint64_t now = sctime_now();
+
+		if (!now)
+			return 0;
+
+		*length = sctime_encode(now, data);
+
+		return 1;
+	}
+
 	return 0;
 }
 
@@ -12,6 +12,7 @@
 #define TELEMETRY_H_
 
 #define TM_LED_STATUS 0 /**< Telemetry which reports LED status */
+#define TM_SPACECRAFT_TIME 1 /**< Telemetry which reports spacecraft time in Time Sync format */
 
 #endif
 
@@ -52,6 +52,11 @@ bool timer_is_overflow(struct timer *base)
 	return IsBitSet(base->tmcr, TIMER_TMCR_OVR);
 }
 
+uint16_t timer_get_count(struct timer *base)
+{
+	return base->tmtr;
+}
+
 void timer_enable(struct timer *base, bool enabled)
 {
 	WriteBitsTyped(base->tmcr, TIMER_TMCR_TE, enabled, uint8_t);
@@ -111,6 +111,13 @@ void timer_set_interrupt(struct timer *base, bool enabled);
  */
 bool timer_is_overflow(struct timer *base);
 
+/**
+ * @brief Get current value of timer counter.
+ * @param [in] base Timer base address.
+ * @retval Counter value, from 0 to period register value.
+ */
+uint16_t timer_get_count(struct timer *base);
+
 /**
  * @brief Enable or disable timer.
  * @param [in] base Timer base address.